@@ -57,6 +57,18 @@ def assemble(args, run_params, out_file, log_file, config_path):
 
     if args.extra_params:
         cmdline.extend(["--extra-params", args.extra_params])
+    if args.memory_limit:
+        cmdline.extend(["--memory-limit", str(args.memory_limit)])
+    if args.deterministic:
+        cmdline.append("--deterministic")
+
+    #intermediate results are saved, so the interrupted stage
+    #could be continued with --resume
+    if args.checkpoints:
+        cmdline.extend(["--checkpoint-dir",
+                        os.path.join(os.path.dirname(out_file), "checkpoints")])
+        if args.resume or args.resume_from:
+            cmdline.append("--resume")
 
     #if args.min_kmer_count is not None:
     #    cmdline.extend(["-m", str(args.min_kmer_count)])
@@ -55,6 +55,8 @@ def analyse_repeats(args, run_params, input_assembly, out_folder,
 
     if args.extra_params:
         cmdline.extend(["--extra-params", args.extra_params])
+    if args.memory_limit:
+        cmdline.extend(["--memory-limit", str(args.memory_limit)])
 
     try:
         logger.debug("Running: " + " ".join(cmdline))
@@ -86,6 +88,8 @@ def generate_contigs(args, run_params, graph_edges, out_folder,
 
     if args.extra_params:
         cmdline.extend(["--extra-params", args.extra_params])
+    if args.memory_limit:
+        cmdline.extend(["--memory-limit", str(args.memory_limit)])
 
     try:
         logger.debug("Running: " + " ".join(cmdline))
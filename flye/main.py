@@ -621,7 +621,8 @@ def _usage():
             "\t     [--meta] [--plasmids] [--trestle] [--polish-target]\n"
             "\t     [--keep-haplotypes] [--debug] [--version] [--help] \n"
             "\t     [--scaffold] [--resume] [--resume-from] [--stop-after] \n"
-            "\t     [--hifi-error float] [--extra-params] [--min-overlap SIZE]")
+            "\t     [--hifi-error float] [--extra-params] [--min-overlap SIZE]\n"
+            "\t     [--memory-limit SIZE] [--deterministic] [--checkpoints]")
 
 
 def _epilog():
@@ -719,6 +720,19 @@ def main():
     parser.add_argument("--extra-params", dest="extra_params",
                         metavar="extra_params", required=False, default=None,
                         help="extra configuration parameters list (comma-separated)")
+    parser.add_argument("--memory-limit", dest="memory_limit",
+                        metavar="size", required=False, default=None,
+                        help="memory budget, the assembly switches to lower-memory "
+                        "strategies to stay within it (for example, 32g) [available RAM]")
+    parser.add_argument("--deterministic", action="store_true",
+                        dest="deterministic", default=False,
+                        help="disjointig assembly results do not depend on "
+                        "the number of threads")
+    parser.add_argument("--checkpoints", action="store_true",
+                        dest="checkpoints", default=False,
+                        help="save intermediate results of disjointig assembly, "
+                        "so an interrupted run continues from them with --resume "
+                        "(needs extra disk space) [disabled by default]")
     parser.add_argument("--plasmids", action="store_true",
                         dest="plasmids", default=False,
                         help="rescue short unassembled plasmids")
@@ -762,6 +776,13 @@ def main():
     if args.hifi_error and not args.pacbio_hifi:
         parser.error("--hifi-error can only be used with --pacbio-hifi")
 
+    if args.memory_limit:
+        try:
+            args.memory_limit = (int(args.memory_limit) if args.memory_limit.isdigit()
+                                 else human2bytes(args.memory_limit.upper()))
+        except ValueError:
+            parser.error("Can't parse --memory-limit value: " + args.memory_limit)
+
     if args.hifi_error:
         hifi_str = "assemble_ovlp_divergence={0},repeat_graph_ovlp_divergence={0}".format(args.hifi_error)
         if args.extra_params:
@@ -0,0 +1,263 @@
+#!/usr/bin/env python
+
+#(c) 2020 by Authors
+#This file is a part of the Flye package.
+#Released under the BSD license (see LICENSE file)
+
+"""
+End-to-end scaling benchmark on a simulated genome. Simulates
+a (diploid) genome with repeats and long reads with a platform-like
+error model, runs the full pipeline with different numbers of threads
+and reports wall time, CPU efficiency and peak RSS of each stage
+(taken from the flye_profile.jsonl reports of the binary modules)
+"""
+
+from __future__ import print_function
+from __future__ import division
+
+import os
+import sys
+import json
+import time
+import random
+import shutil
+import argparse
+import subprocess
+from distutils.spawn import find_executable
+
+
+#error rate and the fractions of substitutions / insertions / deletions
+ERROR_MODELS = {"pacbio-raw": (0.12, 0.15, 0.50, 0.35),
+                "nano-raw": (0.10, 0.40, 0.20, 0.40),
+                "pacbio-hifi": (0.002, 0.20, 0.40, 0.40)}
+
+COMPLEMENT = {"A": "T", "C": "G", "G": "C", "T": "A"}
+
+
+def random_seq(rng, length):
+    return "".join(rng.choice("ACGT") for _ in range(length))
+
+
+def reverse_complement(seq):
+    return "".join(COMPLEMENT[n] for n in reversed(seq))
+
+
+def mutate(rng, seq, error_rate, model):
+    """
+    Introduces errors at the given rate. Positions of the errors
+    are sampled with geometric jumps, so the run time depends
+    on the number of errors rather than on the sequence length
+    """
+    if error_rate <= 0:
+        return seq
+
+    _rate, subs_frac, ins_frac, _del_frac = model
+    chunks = []
+    prev_pos = 0
+    pos = int(rng.expovariate(error_rate))
+    while pos < len(seq):
+        chunks.append(seq[prev_pos:pos])
+        roll = rng.random()
+        if roll < subs_frac:
+            chunks.append(rng.choice([n for n in "ACGT" if n != seq[pos]]))
+        elif roll < subs_frac + ins_frac:
+            #insertions in long reads tend to extend homopolymers
+            chunks.append(seq[pos] * 2 if rng.random() < 0.5
+                          else seq[pos] + rng.choice("ACGT"))
+        #else - deletion
+        prev_pos = pos + 1
+        pos = prev_pos + int(rng.expovariate(error_rate))
+    chunks.append(seq[prev_pos:])
+    return "".join(chunks)
+
+
+def simulate_genome(rng, size, repeat_spectrum, heterozygosity):
+    """
+    Returns haplotypes of the genome. Repeat spectrum is the list of
+    (repeat length, number of copies) pairs; copies are diverged by 1%
+    """
+    genome = list(random_seq(rng, size))
+    for rep_len, num_copies in repeat_spectrum:
+        if rep_len >= size:
+            continue
+        unit = random_seq(rng, rep_len)
+        for _ in range(num_copies):
+            copy = mutate(rng, unit, 0.01, (0.01, 1.0, 0.0, 0.0))
+            pos = rng.randint(0, size - rep_len)
+            genome[pos : pos + rep_len] = copy
+    genome = "".join(genome)
+
+    if heterozygosity <= 0:
+        return [genome]
+    second_hap = mutate(rng, genome, heterozygosity, (heterozygosity, 0.8, 0.1, 0.1))
+    return [genome, second_hap]
+
+
+def simulate_reads(rng, haplotypes, coverage, mean_length, model, out_file):
+    """
+    Samples reads from both strands of all haplotypes, read lengths
+    are drawn from a log-normal distribution
+    """
+    total_len = coverage * len(haplotypes[0])
+    sampled_len = 0
+    read_id = 0
+    with open(out_file, "w") as f:
+        while sampled_len < total_len:
+            hap = rng.choice(haplotypes)
+            length = int(rng.lognormvariate(0, 0.5) * mean_length)
+            length = max(500, min(length, len(hap)))
+            start = rng.randint(0, len(hap) - length)
+            read = hap[start : start + length]
+            if rng.random() < 0.5:
+                read = reverse_complement(read)
+            read = mutate(rng, read, model[0], model)
+            f.write(">read_{0}\n{1}\n".format(read_id, read))
+            read_id += 1
+            sampled_len += length
+    return read_id
+
+
+def load_profiles(out_dir):
+    """
+    Collects the per-module profile records written by the binaries
+    """
+    records = []
+    for root, _dirs, files in os.walk(out_dir):
+        if "flye_profile.jsonl" in files:
+            with open(os.path.join(root, "flye_profile.jsonl")) as f:
+                for line in f:
+                    if line.strip():
+                        records.append(json.loads(line))
+    return records
+
+
+def run_flye(flye_bin, read_type, reads_file, genome_size, threads, out_dir):
+    cmd = [flye_bin, "--" + read_type, reads_file, "-g", str(genome_size),
+           "-o", out_dir, "-t", str(threads)]
+    start = time.time()
+    with open(os.devnull, "w") as devnull:
+        subprocess.check_call(cmd, stdout=devnull, stderr=devnull)
+    return time.time() - start
+
+
+def parse_spectrum(spectrum_str):
+    spectrum = []
+    for pair in spectrum_str.split(","):
+        if pair:
+            length, copies = pair.split(":")
+            spectrum.append((int(length), int(copies)))
+    return spectrum
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Flye scaling benchmark "
+                                     "on a simulated genome")
+    parser.add_argument("--genome-size", type=int, default=1000000,
+                        help="simulated genome size [1000000]")
+    parser.add_argument("--repeats", default="2000:20,10000:4",
+                        help="repeat spectrum as comma-separated length:copies "
+                        "pairs [2000:20,10000:4]")
+    parser.add_argument("--heterozygosity", type=float, default=0.0,
+                        help="divergence of the second haplotype, 0 for haploid [0]")
+    parser.add_argument("--coverage", type=int, default=30,
+                        help="read coverage [30]")
+    parser.add_argument("--read-length", type=int, default=10000,
+                        help="mean read length [10000]")
+    parser.add_argument("--read-type", default="pacbio-raw",
+                        choices=sorted(ERROR_MODELS.keys()),
+                        help="read type, defines the error model [pacbio-raw]")
+    parser.add_argument("--threads", default="1,2,4",
+                        help="comma-separated list of thread numbers [1,2,4]")
+    parser.add_argument("--weak-scaling", action="store_true",
+                        help="scale genome size proportionally to the number "
+                        "of threads (otherwise, strong scaling)")
+    parser.add_argument("--seed", type=int, default=42, help="random seed [42]")
+    parser.add_argument("--work-dir", default="flye_bench_scaling",
+                        help="working directory [flye_bench_scaling]")
+    parser.add_argument("--keep", action="store_true",
+                        help="keep the simulated data and assemblies")
+    args = parser.parse_args()
+
+    flye_bin = find_executable("flye")
+    if not flye_bin:
+        sys.exit("flye is not installed!")
+
+    #sorted, so the smallest number of threads is the speedup reference
+    threads_list = sorted(int(t) for t in args.threads.split(","))
+    spectrum = parse_spectrum(args.repeats)
+    model = ERROR_MODELS[args.read_type]
+    #a user-supplied directory may hold other files, so only
+    #the directory created here is removed as a whole
+    created_work_dir = not os.path.isdir(args.work_dir)
+    if created_work_dir:
+        os.makedirs(args.work_dir)
+
+    datasets = {}
+    results = []
+    for threads in threads_list:
+        genome_size = args.genome_size * (threads if args.weak_scaling else 1)
+        if genome_size not in datasets:
+            rng = random.Random(args.seed)
+            reads_file = os.path.join(args.work_dir,
+                                      "reads_{0}.fasta".format(genome_size))
+            print("Simulating {0} bp genome".format(genome_size), file=sys.stderr)
+            haplotypes = simulate_genome(rng, genome_size, spectrum,
+                                         args.heterozygosity)
+            num_reads = simulate_reads(rng, haplotypes, args.coverage,
+                                       args.read_length, model, reads_file)
+            print("Simulated {0} reads".format(num_reads), file=sys.stderr)
+            datasets[genome_size] = reads_file
+
+        out_dir = os.path.join(args.work_dir, "flye_t{0}".format(threads))
+        if os.path.isdir(out_dir):
+            shutil.rmtree(out_dir)
+        print("Running with {0} threads".format(threads), file=sys.stderr)
+        total_wall = run_flye(flye_bin, args.read_type, datasets[genome_size],
+                              genome_size, threads, out_dir)
+
+        #modules that run multiple times (e.g. polisher iterations) are merged
+        modules = []
+        module_index = {}
+        for record in load_profiles(out_dir):
+            top = record["phases"][0]
+            if record["module"] not in module_index:
+                module_index[record["module"]] = len(modules)
+                modules.append([record["module"], 0, 0, 0])
+            stage = modules[module_index[record["module"]]]
+            stage[1] += top["wall_sec"]
+            stage[2] += top["cpu_sec"]
+            stage[3] = max(stage[3], top["peak_rss_mb"])
+        results.append((threads, genome_size, total_wall, modules))
+        if not args.keep:
+            shutil.rmtree(out_dir)
+
+    #reference for speedup: the same stage with the smallest number of threads
+    base_wall = {}
+    for _threads, _size, total_wall, modules in results:
+        base_wall.setdefault("total", total_wall)
+        for module, wall, _cpu, _rss in modules:
+            base_wall.setdefault(module, wall)
+
+    header = ("threads", "genome", "stage", "wall_sec", "cpu_sec",
+              "cpu_eff", "speedup", "peak_rss_mb")
+    print("\t".join(header))
+    for threads, size, total_wall, modules in results:
+        for module, wall, cpu, rss in modules:
+            print("{0}\t{1}\t{2}\t{3:.2f}\t{4:.2f}\t{5:.2f}\t{6:.2f}\t{7:.0f}"
+                  .format(threads, size, module, wall, cpu,
+                          cpu / wall / threads if wall > 0 else 0,
+                          base_wall[module] / wall if wall > 0 else 0, rss))
+        print("{0}\t{1}\ttotal\t{2:.2f}\t-\t-\t{3:.2f}\t-"
+              .format(threads, size, total_wall, base_wall["total"] / total_wall))
+
+    if not args.keep:
+        if created_work_dir:
+            shutil.rmtree(args.work_dir)
+        else:
+            for reads_file in datasets.values():
+                os.remove(reads_file)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
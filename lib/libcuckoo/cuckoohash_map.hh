@@ -590,6 +590,20 @@ public:
     return find_fn(key, [](const mapped_type &) {});
   }
 
+  /**
+   * Issues software prefetches for the two buckets where @p key could be
+   * stored (and their locks), so a subsequent lookup of @p key does not
+   * stall on cache misses. Takes no locks and does not modify the table.
+   */
+  template <typename K> void prefetch(const K &key) const {
+    const hash_value hv = hashed_key(key);
+    const size_type hp = hashpower();
+    const size_type i1 = index_hash(hp, hv.hash);
+    const size_type i2 = alt_index(hp, hv.partial, i1);
+    prefetch_bucket(i1);
+    prefetch_bucket(i2);
+  }
+
   /**
    * Updates the value associated with @p key to @p val. Equivalent to
    * calling @ref update_fn with a functor that assigns the existing mapped
@@ -996,6 +1010,15 @@ private:
     return bucket_ind & (kMaxNumLocks - 1);
   }
 
+  // prefetch_bucket prefetches a bucket (which could span two cache
+  // lines) and its lock, which is written when the bucket is locked.
+  void prefetch_bucket(const size_type ind) const {
+    const char *bucket_ptr = reinterpret_cast<const char *>(&buckets_[ind]);
+    __builtin_prefetch(bucket_ptr);
+    __builtin_prefetch(bucket_ptr + sizeof(bucket) - 1);
+    __builtin_prefetch(&get_current_locks()[lock_ind(ind)], 1);
+  }
+
   // Data storage types and functions
 
   // The type of the bucket
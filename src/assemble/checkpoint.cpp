@@ -0,0 +1,202 @@
+//(c) 2016-2020 by Authors
+//This file is a part of Flye program.
+//Released under the BSD license (see LICENSE file)
+
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "../common/logger.h"
+
+namespace
+{
+	const char HEADER_MAGIC[] = "FLYECKP1";
+	const char FOOTER_MAGIC[] = "FLYEEND1";
+	const size_t MAGIC_LEN = 8;
+	const std::string SUFFIX = ".ckpt";
+
+	void writeString(std::ostream& out, const std::string& str)
+	{
+		AssemblyCheckpoint::writeValue<uint64_t>(out, str.size());
+		out.write(str.data(), str.size());
+	}
+
+	std::string readString(std::istream& in)
+	{
+		uint64_t size = AssemblyCheckpoint::readValue<uint64_t>(in);
+		std::string str(size, '\0');
+		if (!in.read(&str[0], size))
+		{
+			throw std::runtime_error("Unexpected end of checkpoint");
+		}
+		return str;
+	}
+}
+
+void AssemblyCheckpoint::init(const std::string& dir,
+							  const std::string& fingerprint, bool resume)
+{
+	_dir = dir;
+	_fingerprint = fingerprint;
+	_resume = resume;
+	mkdir(_dir.c_str(), 0755);
+}
+
+std::string AssemblyCheckpoint::filename(const std::string& name) const
+{
+	return _dir + "/" + name + SUFFIX;
+}
+
+//checks the fingerprint in the header and that the file was
+//completely written, leaves the stream after the header
+bool AssemblyCheckpoint::isValid(std::istream& in)
+{
+	char magic[MAGIC_LEN];
+	in.seekg(-(std::streamoff)MAGIC_LEN, std::ios::end);
+	if (!in.read(magic, MAGIC_LEN) ||
+		strncmp(magic, FOOTER_MAGIC, MAGIC_LEN)) return false;
+
+	in.seekg(0, std::ios::beg);
+	if (!in.read(magic, MAGIC_LEN) ||
+		strncmp(magic, HEADER_MAGIC, MAGIC_LEN)) return false;
+	try
+	{
+		return readString(in) == _fingerprint;
+	}
+	catch (std::runtime_error&)
+	{
+		return false;
+	}
+}
+
+bool AssemblyCheckpoint::load(const std::string& name,
+							  std::function<void(std::istream&)> reader)
+{
+	if (!this->enabled() || !_resume) return false;
+
+	std::ifstream fin(this->filename(name), std::ios::binary);
+	if (!fin.is_open() || !this->isValid(fin))
+	{
+		Logger::get().debug() << "No valid checkpoint for " << name
+			<< ", the following steps will be recomputed";
+		_resume = false;
+		return false;
+	}
+	reader(fin);
+	Logger::get().info() << "Restored " << name << " from checkpoint";
+	return true;
+}
+
+void AssemblyCheckpoint::save(const std::string& name,
+							  std::function<void(std::ostream&)> writer)
+{
+	if (!this->enabled()) return;
+
+	std::string tmpName = this->filename(name) + ".tmp";
+	{
+		std::ofstream fout(tmpName, std::ios::binary);
+		if (!fout.is_open())
+		{
+			Logger::get().warning() << "Can't write checkpoint " << tmpName;
+			return;
+		}
+		fout.write(HEADER_MAGIC, MAGIC_LEN);
+		writeString(fout, _fingerprint);
+		writer(fout);
+		fout.write(FOOTER_MAGIC, MAGIC_LEN);
+		if (!fout.good())
+		{
+			Logger::get().warning() << "Error writing checkpoint " << tmpName;
+			std::remove(tmpName.c_str());
+			return;
+		}
+	}
+	if (std::rename(tmpName.c_str(), this->filename(name).c_str()) != 0)
+	{
+		Logger::get().warning() << "Can't write checkpoint " << name;
+		return;
+	}
+	Logger::get().debug() << "Saved checkpoint: " << name;
+}
+
+void AssemblyCheckpoint::clear()
+{
+	if (!this->enabled()) return;
+
+	DIR* dir = opendir(_dir.c_str());
+	if (!dir) return;
+	while (dirent* entry = readdir(dir))
+	{
+		std::string name = entry->d_name;
+		if (name.find(SUFFIX) != std::string::npos)
+		{
+			std::remove((_dir + "/" + name).c_str());
+		}
+	}
+	closedir(dir);
+	rmdir(_dir.c_str());
+}
+
+void AssemblyCheckpoint::writeId(std::ostream& out, FastaRecord::Id id)
+{
+	writeValue<int32_t>(out, id.signedId());
+}
+
+FastaRecord::Id AssemblyCheckpoint::readId(std::istream& in)
+{
+	int32_t signedId = readValue<int32_t>(in);
+	return FastaRecord::Id(signedId > 0 ? (signedId - 1) * 2 :
+										  (-signedId - 1) * 2 + 1);
+}
+
+//only positive strands are stored (the complements are restored
+//by the container), nucleotides are packed four per byte
+void AssemblyCheckpoint::saveReads(const SequenceContainer& seqContainer,
+								   std::ostream& out)
+{
+	writeValue<uint64_t>(out, seqContainer.iterSeqs().size() / 2);
+	std::string packed;
+	for (const auto& seq : seqContainer.iterSeqs())
+	{
+		if (!seq.id.strand()) continue;
+
+		writeString(out, seq.description.substr(1));	//without strand sign
+		size_t length = seq.sequence.length();
+		writeValue<uint64_t>(out, length);
+		packed.assign((length + 3) / 4, 0);
+		for (size_t i = 0; i < length; ++i)
+		{
+			packed[i / 4] |= seq.sequence.atRaw(i) << (i % 4) * 2;
+		}
+		out.write(packed.data(), packed.size());
+	}
+}
+
+void AssemblyCheckpoint::loadReads(SequenceContainer& seqContainer,
+								   std::istream& in)
+{
+	MemoryArena::Scope arenaScope;
+	uint64_t numSeqs = readValue<uint64_t>(in);
+	std::string packed;
+	std::string sequence;
+	for (size_t seqId = 0; seqId < numSeqs; ++seqId)
+	{
+		std::string description = readString(in);
+		size_t length = readValue<uint64_t>(in);
+		packed.resize((length + 3) / 4);
+		if (!in.read(&packed[0], packed.size()))
+		{
+			throw std::runtime_error("Unexpected end of checkpoint");
+		}
+		sequence.resize(length);
+		for (size_t i = 0; i < length; ++i)
+		{
+			sequence[i] = DnaSequence::idToDna((packed[i / 4] >> (i % 4) * 2) & 3);
+		}
+		seqContainer.addSequence(DnaSequence(sequence), description);
+	}
+}
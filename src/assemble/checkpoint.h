@@ -0,0 +1,76 @@
+//(c) 2016-2020 by Authors
+//This file is a part of Flye program.
+//Released under the BSD license (see LICENSE file)
+
+//Intra-stage checkpoints of the assemble module. Each completed step
+//(reads loading, index construction, overlap parameters estimation,
+//disjointig extension progress) is saved into a separate file, so that
+//a restarted run could continue from the last saved step, instead of
+//starting the whole stage from scratch
+
+#pragma once
+
+#include <string>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+
+#include "../sequence/sequence_container.h"
+
+class AssemblyCheckpoint
+{
+public:
+	AssemblyCheckpoint(): _resume(false) {}
+
+	//fingerprint describes the input and the parameters - checkpoints
+	//with a different fingerprint are ignored
+	void init(const std::string& dir, const std::string& fingerprint,
+			  bool resume);
+
+	bool enabled() const {return !_dir.empty();}
+
+	//returns false if the checkpoint does not exist or is not valid.
+	//Since the steps depend on the previous ones, once a checkpoint
+	//is missing, all the subsequent ones are ignored as well
+	bool load(const std::string& name,
+			  std::function<void(std::istream&)> reader);
+
+	//the checkpoint is replaced atomically
+	void save(const std::string& name,
+			  std::function<void(std::ostream&)> writer);
+
+	//removes all checkpoints (after the stage is completed)
+	void clear();
+
+	static void saveReads(const SequenceContainer& seqContainer,
+						  std::ostream& out);
+	static void loadReads(SequenceContainer& seqContainer, std::istream& in);
+
+	static void writeId(std::ostream& out, FastaRecord::Id id);
+	static FastaRecord::Id readId(std::istream& in);
+
+	template <class T>
+	static void writeValue(std::ostream& out, const T& value)
+	{
+		out.write((const char*)&value, sizeof(T));
+	}
+
+	template <class T>
+	static T readValue(std::istream& in)
+	{
+		T value;
+		if (!in.read((char*)&value, sizeof(T)))
+		{
+			throw std::runtime_error("Unexpected end of checkpoint");
+		}
+		return value;
+	}
+
+private:
+	std::string filename(const std::string& name) const;
+	bool isValid(std::istream& in);
+
+	std::string _dir;
+	std::string _fingerprint;
+	bool _resume;
+};
@@ -8,6 +8,7 @@
 #include <unordered_map>
 #include <iomanip>
 #include <cmath>
+#include <random>
 
 #include "../common/config.h"
 #include "../common/logger.h"
@@ -29,12 +30,20 @@
 }*/
 
 bool ChimeraDetector::isChimeric(FastaRecord::Id readId,
-								 const std::vector<OverlapRange>& readOvlps)
+								 const std::vector<OverlapRange>& readOvlps,
+								 bool useCache)
 {
+	if (!useCache) return this->testReadByCoverage(readId, readOvlps);
+
 	//const int JUMP = Config::get("maximum_jump");
 	if (!_chimeras.contains(readId))
 	{
-		bool result = this->testReadByCoverage(readId, readOvlps);
+		//the cached result is computed for the positive strand, so it
+		//does not depend on which strand was queried first
+		bool result = readId.strand() ? 
+			this->testReadByCoverage(readId, readOvlps) :
+			this->testReadByCoverage(readId.rc(), 
+									 _ovlpContainer.lazySeqOverlaps(readId.rc()));
 		/*for (const auto& ovlp : IterNoOverhang(readOvlps))
 		{
 			if (ovlp.curId == ovlp.extId.rc()) 
@@ -71,9 +80,12 @@ void ChimeraDetector::estimateGlobalCoverage()
 
 	int64_t sum = 0;
 	int64_t num = 0;
+	//fixed seed, so the sample is the same in every run
+	const int SAMPLING_SEED = 42;
+	std::mt19937 randGen(SAMPLING_SEED);
 	for (const auto& seq : _seqContainer.iterSeqs())
 	{
-		if (rand() % sampleRate) continue;
+		if (randGen() % sampleRate) continue;
 		auto coverage = this->getReadCoverage(seq.id, _ovlpContainer.lazySeqOverlaps(seq.id));
 		bool nonZero = false;
 		for (auto c : coverage) nonZero |= (c != 0);
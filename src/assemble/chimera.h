@@ -20,9 +20,13 @@ public:
 
 	void estimateGlobalCoverage();
 	//bool isChimeric(FastaRecord::Id readId);
+	//if useCache is not set, the read is tested with the given overlaps,
+	//otherwise the cached result for the read is used (if computed before)
 	bool isChimeric(FastaRecord::Id readId, 
-					const std::vector<OverlapRange>& readOvlps);
+					const std::vector<OverlapRange>& readOvlps,
+					bool useCache = true);
 	int  getOverlapCoverage() const {return _overlapCoverage;}
+	void setOverlapCoverage(int coverage) {_overlapCoverage = coverage;}
 	int  getRightTrim(FastaRecord::Id readId);
 	bool isRepetitiveRegion(FastaRecord::Id readId, int32_t start, int32_t end, bool debug=false);
 
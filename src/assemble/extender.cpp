@@ -7,14 +7,65 @@
 #include <iomanip>
 #include <stack>
 #include <cmath>
+#include <chrono>
+#include <numeric>
+#include <atomic>
 
 #include "../common/config.h"
 #include "../common/logger.h"
 #include "../common/parallel.h"
 #include "extender.h"
 
+namespace
+{
+	//number of extensions and their total length (in reads)
+	struct ExtensionWork
+	{
+		ExtensionWork(): count(0), steps(0) {}
+		void add(size_t numSteps) 
+		{
+			++count;
+			steps += numSteps;
+		}
+
+		std::atomic<size_t> count;
+		std::atomic<size_t> steps;
+	};
+}
+
+bool Extender::isInnerRead(FastaRecord::Id readId, InnerLookups* innerLookups)
+{
+	bool inner = _innerReads.contains(readId);
+	if (!inner && innerLookups) innerLookups->push_back(readId);
+	return inner;
+}
+
+bool Extender::claimRead(FastaRecord::Id readId, size_t ticket)
+{
+	if (!readId.strand()) readId = readId.rc();
+	bool claimed = true;
+	_claimedReads.upsert(readId, 
+		[ticket, &claimed](size_t& owner)
+		{
+			if (owner < ticket) claimed = false;
+			else owner = ticket;
+		}, ticket);
+	return claimed;
+}
 
-Extender::ExtensionInfo Extender::extendDisjointig(FastaRecord::Id startRead)
+void Extender::releaseClaims(const ExtensionInfo& exInfo, size_t ticket)
+{
+	for (auto readId : exInfo.reads)
+	{
+		if (!readId.strand()) readId = readId.rc();
+		_claimedReads.erase_fn(readId, 
+			[ticket](size_t& owner) {return owner == ticket;});
+	}
+}
+
+Extender::ExtensionInfo Extender::extendDisjointig(FastaRecord::Id startRead,
+												   InnerLookups* innerLookups,
+												   size_t claimTicket)
 {
 
 	std::unordered_set<FastaRecord::Id> currentReads;
@@ -28,6 +79,11 @@ Extender::ExtensionInfo Extender::extendDisjointig(FastaRecord::Id startRead)
 	ExtensionInfo exInfo;
 	exInfo.reads.push_back(startRead);
 	exInfo.assembledLength = _readsContainer.seqLen(startRead);
+	if (claimTicket && !this->claimRead(startRead, claimTicket))
+	{
+		exInfo.aborted = true;
+		return exInfo;
+	}
 
 	auto startOverlaps = _ovlpContainer.lazySeqOverlaps(startRead);
 	auto leftExtendsStart = [startRead, this, &startOverlaps](const FastaRecord::Id readId)
@@ -146,6 +202,15 @@ Extender::ExtensionInfo Extender::extendDisjointig(FastaRecord::Id startRead)
 			exInfo.reads.push_back(currentRead);
 			overlapSizes.push_back(selectedExtension->curRange());
 
+			//the read is being extended by a higher priority disjointig,
+			//which is likely to make this extension mostly inner
+			if (claimTicket && !_innerReads.contains(currentRead) &&
+				!this->claimRead(currentRead, claimTicket))
+			{
+				exInfo.aborted = true;
+				return exInfo;
+			}
+
 			//_chimDetector.isRepetitiveRegion(selectedExtension->curId, selectedExtension->curBegin, 
 			//								 selectedExtension->curEnd, true);
 			//_chimDetector.isRepetitiveRegion(selectedExtension->extId, selectedExtension->extBegin, 
@@ -156,7 +221,7 @@ Extender::ExtensionInfo Extender::extendDisjointig(FastaRecord::Id startRead)
 			rightExtension ? exInfo.leftTip = true : exInfo.rightTip = true;
 		}
 
-		if (!selectedExtension || _innerReads.contains(currentRead) ||
+		if (!selectedExtension || this->isInnerRead(currentRead, innerLookups) ||
 			currentReads.count(currentRead))
 		{
 			//Logger::get().debug() << "Not found: " << !foundExtension << 
@@ -213,10 +278,39 @@ Extender::ExtensionInfo Extender::extendDisjointig(FastaRecord::Id startRead)
 void Extender::assembleDisjointigs()
 {
 	Logger::get().info() << "Extending reads";
-	_chimDetector.estimateGlobalCoverage();
-	_ovlpContainer.overlapDivergenceStats();
+	auto loadCoverage = [this](std::istream& in)
+	{
+		_chimDetector.setOverlapCoverage(AssemblyCheckpoint::readValue<int32_t>(in));
+	};
+	if (_checkpoint && _checkpoint->load("overlap_coverage", loadCoverage))
+	{
+		Logger::get().info() << "Overlap-based coverage: " 
+			<< _chimDetector.getOverlapCoverage();
+	}
+	else
+	{
+		_chimDetector.estimateGlobalCoverage();
+		_ovlpContainer.overlapDivergenceStats();
+		if (_checkpoint) _checkpoint->save("overlap_coverage", 
+			[this](std::ostream& out)
+			{
+				AssemblyCheckpoint::writeValue<int32_t>(out, 
+									_chimDetector.getOverlapCoverage());
+			});
+	}
 	_innerReads.clear();
-	cuckoohash_map<FastaRecord::Id, size_t> coveredReads;
+	ReadSet coveredReads;
+
+	//start reads that were already processed before the last snapshot
+	ReadSet processedReads;
+	if (_checkpoint)
+	{
+		_checkpoint->load("extension", 
+			[this, &coveredReads, &processedReads](std::istream& in)
+			{this->loadSnapshot(in, coveredReads, processedReads);});
+	}
+	const auto SNAPSHOT_INTERVAL = std::chrono::minutes(5);
+	auto lastSnapshot = std::chrono::steady_clock::now();
 	
 	int totalReads = 0;
 	for (const auto& read : _readsContainer.iterSeqs())
@@ -227,13 +321,17 @@ void Extender::assembleDisjointigs()
 	
 	std::mutex indexMutex;
 	ProgressPercent progress(totalReads);
-	progress.setValue(0);
-	auto processRead = [this, &indexMutex, &coveredReads, totalReads, &progress] 
-		(FastaRecord::Id startRead)
+	progress.setValue(coveredReads.size());
+
+	//checks if the read is a good start and extends it into a disjointig.
+	//The inner reads index is only read at this step
+	auto extendFromRead = [this, &coveredReads] 
+		(FastaRecord::Id startRead, InnerLookups* innerLookups,
+		 ExtensionInfo& exInfo, size_t claimTicket)
 	{
 		//most of the reads will fall into the inner categoty -
 		//so no further processing will be needed
-		if (_innerReads.contains(startRead)) return;
+		if (this->isInnerRead(startRead, innerLookups)) return false;
 
 		coveredReads.insert(startRead);
 		coveredReads.insert(startRead.rc());
@@ -247,7 +345,7 @@ void Extender::assembleDisjointigs()
 		int totalOverlaps = 0;
 		for (const auto& ovlp : IterNoOverhang(startOvlps))
 		{
-			if (_innerReads.contains(ovlp.extId)) ++numInnerOvlp;
+			if (this->isInnerRead(ovlp.extId, innerLookups)) ++numInnerOvlp;
 			++totalOverlaps;
 		}
 
@@ -256,24 +354,45 @@ void Extender::assembleDisjointigs()
 		int extLeft = this->countLeftExtensions(startOvlps);
 		int extRight = this->countRightExtensions(startOvlps);
 
-		if (_chimDetector.isChimeric(startRead, startOvlps) ||
+		//in the deterministic mode, the chimera status of the start read
+		//is not taken from the cache, because the cached value depends on
+		//which overlaps (quick or complete) were used first
+		bool useCache = !Parameters::get().deterministic;
+		if (_chimDetector.isChimeric(startRead, startOvlps, useCache) ||
 			_readsContainer.seqLen(startRead) < _safeOverlap ||
 			std::max(extLeft, extRight) > maxStartExt ||
 			std::min(extLeft, extRight) < minStartExt ||
-			numInnerOvlp > totalOverlaps / 2) return;
+			numInnerOvlp > totalOverlaps / 2) return false;
 		
 		//Good to go!
-		ExtensionInfo exInfo = this->extendDisjointig(startRead);
+		exInfo = this->extendDisjointig(startRead, innerLookups, claimTicket);
+		return true;
+	};
 
-		//Exclusive part - updating the overall assembly
-		std::lock_guard<std::mutex> guard(indexMutex);
+	//Exclusive part - updating the overall assembly. If newInner is given,
+	//the reads that became inner are added to it. Returns true if
+	//the disjointig was accepted
+	auto commitExtension = [this, &coveredReads, totalReads, &progress]
+		(FastaRecord::Id startRead, ExtensionInfo& exInfo,
+		 std::unordered_set<FastaRecord::Id>* newInner)
+	{
+		auto markInner = [this, newInner](FastaRecord::Id readId)
+		{
+			_innerReads.insert(readId, true);
+			_innerReads.insert(readId.rc(), true);
+			if (newInner)
+			{
+				newInner->insert(readId);
+				newInner->insert(readId.rc());
+			}
+		};
 
 		if (exInfo.reads.size() - exInfo.numSuspicious < 
 			(size_t)Config::get("min_reads_in_disjointig"))
 		{
 			//Logger::get().debug() << "Thrown away: " << exInfo.reads.size() << " " << exInfo.numSuspicious
 			//	<< " " << exInfo.leftTip << " " << exInfo.rightTip;
-			return;
+			return false;
 		}
 
 		/*if (exInfo.leftAsmOverlap + exInfo.rightAsmOverlap > 
@@ -299,7 +418,7 @@ void Extender::assembleDisjointigs()
 			Logger::get().debug() << "Discarded disjointig with "
 				<< exInfo.reads.size() << " reads and "
 				<< innerCount << " inner overlaps";
-			return;
+			return false;
 		}
 
 		Logger::get().debug() << "Assembled disjointig " 
@@ -327,8 +446,7 @@ void Extender::assembleDisjointigs()
 		{
 			coveredReads.insert(readId, true);
 			coveredReads.insert(readId.rc(), true);
-			_innerReads.insert(readId, true);
-			_innerReads.insert(readId.rc(), true);
+			markInner(readId);
 
 			//repetitive read - will bring to many "off-target" reads
 			//int maxExtensions = exInfo.meanOverlaps * 2;
@@ -348,8 +466,7 @@ void Extender::assembleDisjointigs()
 		}
 		for (const auto& read : this->getInnerReads(allOverlaps))
 		{
-			_innerReads.insert(read, true);
-			_innerReads.insert(read.rc(), true);
+			markInner(read);
 		}
 
 		Logger::get().debug() << "Inner: " << 
@@ -358,13 +475,22 @@ void Extender::assembleDisjointigs()
 		progress.setValue(coveredReads.size());
 		
 		_readLists.push_back(std::move(exInfo));
+		return true;
 	};
 
-	std::function<void(const FastaRecord::Id&)> threadWorker = 
-		[processRead] (const FastaRecord::Id& readId)
+	auto snapshotIfDue = [this, &coveredReads, &processedReads, 
+						  &lastSnapshot, SNAPSHOT_INTERVAL]()
 	{
-		processRead(readId);
+		auto curTime = std::chrono::steady_clock::now();
+		if (_checkpoint && curTime - lastSnapshot > SNAPSHOT_INTERVAL)
+		{
+			_checkpoint->save("extension", 
+				[this, &coveredReads, &processedReads](std::ostream& out)
+				{this->saveSnapshot(out, coveredReads, processedReads);});
+			lastSnapshot = curTime;
+		}
 	};
+
 	std::vector<FastaRecord::Id> allReads;
 	for (const auto& seq : _readsContainer.iterSeqs())
 	{
@@ -374,14 +500,171 @@ void Extender::assembleDisjointigs()
 			allReads.push_back(seq.id);
 		}
 	}
-	//deterministic shuffling
+	//start reads are prioritized by the expected yield: the reads that
+	//are too short to start a disjointig go last, so they do not occupy
+	//the threads while the useful extensions are running. Otherwise,
+	//the reads are shuffled deterministically, so that the starts are 
+	//spread across the genome (trying longer reads first was found
+	//to give less complete assemblies)
+	auto startPriority = [this](const FastaRecord::Id& readId)
+	{
+		return _readsContainer.seqLen(readId) < _safeOverlap ? 0 : 1;
+	};
 	std::sort(allReads.begin(), allReads.end(), 
-			  [](const FastaRecord::Id& id1, const FastaRecord::Id& id2)
-			  {return id1.hash() < id2.hash();});
-	processInParallel(allReads, threadWorker,
-					  Parameters::get().numThreads, /*progress*/ false);
+			  [&startPriority](const FastaRecord::Id& id1, 
+			  				   const FastaRecord::Id& id2)
+			  {
+			  	int priority1 = startPriority(id1);
+			  	int priority2 = startPriority(id2);
+			  	if (priority1 != priority2) return priority1 > priority2;
+			  	return id1.hash() < id2.hash();
+			  });
+	allReads.erase(std::remove_if(allReads.begin(), allReads.end(),
+				   [&processedReads](const FastaRecord::Id& readId)
+				   {return processedReads.contains(readId);}), 
+				   allReads.end());
+
+	ExtensionWork acceptedWork;
+	ExtensionWork discardedWork;
+	ExtensionWork abortedWork;
+	ExtensionWork recomputedWork;
+	if (!Parameters::get().deterministic)
+	{
+		//Reads are claimed during the extension (with the start read
+		//priority), and an extension that reaches a read claimed by a higher
+		//priority one is aborted early. Aborted start reads are retried after
+		//the current round, when they are likely to be inner already
+		std::vector<size_t> tasks(allReads.size());
+		std::iota(tasks.begin(), tasks.end(), 0);
+		while (!tasks.empty())
+		{
+			std::vector<size_t> abortedTasks;
+			std::function<void(const size_t&)> threadWorker = 
+				[this, &extendFromRead, &commitExtension, &snapshotIfDue,
+				 &indexMutex, &processedReads, &allReads, &abortedTasks,
+				 &acceptedWork, &discardedWork, &abortedWork] (const size_t& task)
+			{
+				FastaRecord::Id startRead = allReads[task];
+				size_t ticket = task + 1;
+				ExtensionInfo exInfo;
+				bool extended = extendFromRead(startRead, nullptr, exInfo, ticket);
+				if (extended && exInfo.aborted)
+				{
+					abortedWork.add(exInfo.reads.size());
+					this->releaseClaims(exInfo, ticket);
+					std::lock_guard<std::mutex> guard(indexMutex);
+					abortedTasks.push_back(task);
+					return;
+				}
+				if (extended)
+				{
+					size_t numSteps = exInfo.reads.size();
+					std::lock_guard<std::mutex> guard(indexMutex);
+					//accepted reads become inner, so the claims are not needed
+					this->releaseClaims(exInfo, ticket);
+					if (commitExtension(startRead, exInfo, nullptr))
+					{
+						acceptedWork.add(numSteps);
+					}
+					else
+					{
+						discardedWork.add(numSteps);
+					}
+					snapshotIfDue();
+				}
+				if (_checkpoint) processedReads.insert(startRead, true);
+			};
+			processInParallel(tasks, threadWorker,
+							  Parameters::get().numThreads, /*progress*/ false);
+			std::sort(abortedTasks.begin(), abortedTasks.end());
+			tasks = std::move(abortedTasks);
+		}
+	}
+	else
+	{
+		//Start reads are processed in batches. Extensions are computed
+		//in parallel against the inner reads of the previous batches, and
+		//then committed in the order of start reads. If a disjointig committed
+		//earlier in the same batch made any of the looked up reads inner,
+		//the extension is recomputed. This gives the same result as the
+		//sequential processing, independently of the number of threads
+		const size_t BATCH_SIZE = Parameters::get().numThreads * 4;
+		for (size_t batchStart = 0; batchStart < allReads.size(); 
+			 batchStart += BATCH_SIZE)
+		{
+			size_t batchSize = std::min(BATCH_SIZE, allReads.size() - batchStart);
+			std::vector<ExtensionInfo> extensions(batchSize);
+			std::vector<InnerLookups> innerLookups(batchSize);
+			std::vector<char> extended(batchSize, false);
+			std::vector<size_t> tasks(batchSize);
+			std::iota(tasks.begin(), tasks.end(), 0);
+
+			std::function<void(const size_t&)> speculativeWorker = 
+				[&extendFromRead, &allReads, &extensions, &innerLookups, 
+				 &extended, batchStart] (const size_t& task)
+			{
+				extended[task] = extendFromRead(allReads[batchStart + task],
+											   &innerLookups[task], 
+											   extensions[task], 
+											   /*no claims*/ 0);
+			};
+			processInParallel(tasks, speculativeWorker,
+							  Parameters::get().numThreads, /*progress*/ false);
+
+			std::unordered_set<FastaRecord::Id> newInner;
+			for (size_t task = 0; task < batchSize; ++task)
+			{
+				FastaRecord::Id startRead = allReads[batchStart + task];
+				bool outdated = false;
+				for (const auto& readId : innerLookups[task])
+				{
+					if (newInner.count(readId))
+					{
+						outdated = true;
+						break;
+					}
+				}
+				if (outdated)
+				{
+					recomputedWork.add(extensions[task].reads.size());
+					extensions[task] = ExtensionInfo();
+					extended[task] = extendFromRead(startRead, nullptr, 
+													extensions[task], 0);
+				}
+				if (extended[task]) 
+				{
+					size_t numSteps = extensions[task].reads.size();
+					if (commitExtension(startRead, extensions[task], &newInner))
+					{
+						acceptedWork.add(numSteps);
+					}
+					else
+					{
+						discardedWork.add(numSteps);
+					}
+				}
+				if (_checkpoint) processedReads.insert(startRead, true);
+			}
+			snapshotIfDue();
+		}
+	}
 	progress.setDone();
 
+	size_t totalSteps = acceptedWork.steps + discardedWork.steps + 
+						abortedWork.steps + recomputedWork.steps;
+	Logger::get().debug() << "Extensions accepted: " << acceptedWork.count
+		<< " (" << acceptedWork.steps << " reads), discarded: " 
+		<< discardedWork.count << " (" << discardedWork.steps 
+		<< " reads), aborted: " << abortedWork.count << " ("
+		<< abortedWork.steps << " reads), recomputed: " << recomputedWork.count
+		<< " (" << recomputedWork.steps << " reads)";
+	if (totalSteps > 0)
+	{
+		Logger::get().debug() << "Wasted extension work: " << std::fixed 
+			<< std::setprecision(1)
+			<< 100.0f * (totalSteps - acceptedWork.steps) / totalSteps << "%";
+	}
+
 	bool addSingletons = (bool)Config::get("add_unassembled_reads");
 	if (addSingletons)
 	{
@@ -429,6 +712,75 @@ void Extender::assembleDisjointigs()
 }
 
 
+void Extender::saveSnapshot(std::ostream& out, ReadSet& coveredReads, 
+						   ReadSet& processedReads)
+{
+	typedef AssemblyCheckpoint Ckpt;
+	Ckpt::writeValue<uint64_t>(out, _readLists.size());
+	for (const auto& exInfo : _readLists)
+	{
+		Ckpt::writeValue<uint64_t>(out, exInfo.reads.size());
+		for (const auto& readId : exInfo.reads) Ckpt::writeId(out, readId);
+		Ckpt::writeValue<uint8_t>(out, exInfo.leftTip);
+		Ckpt::writeValue<uint8_t>(out, exInfo.rightTip);
+		Ckpt::writeValue<int32_t>(out, exInfo.numSuspicious);
+		Ckpt::writeValue<int32_t>(out, exInfo.meanOverlaps);
+		Ckpt::writeValue<int32_t>(out, exInfo.stepsToTurn);
+		Ckpt::writeValue<int32_t>(out, exInfo.assembledLength);
+		Ckpt::writeValue<uint8_t>(out, exInfo.singleton);
+		Ckpt::writeValue<int32_t>(out, exInfo.avgOverlapSize);
+		Ckpt::writeValue<int32_t>(out, exInfo.minOverlapSize);
+		Ckpt::writeValue<int32_t>(out, exInfo.shortExtensions);
+	}
+
+	for (ReadSet* readSet : {&_innerReads, &coveredReads, &processedReads})
+	{
+		auto lockedSet = readSet->lock_table();
+		Ckpt::writeValue<uint64_t>(out, lockedSet.size());
+		for (const auto& read : lockedSet) Ckpt::writeId(out, read.first);
+	}
+}
+
+void Extender::loadSnapshot(std::istream& in, ReadSet& coveredReads, 
+						   ReadSet& processedReads)
+{
+	typedef AssemblyCheckpoint Ckpt;
+	_readLists.clear();
+	size_t numLists = Ckpt::readValue<uint64_t>(in);
+	for (size_t i = 0; i < numLists; ++i)
+	{
+		ExtensionInfo exInfo;
+		size_t numReads = Ckpt::readValue<uint64_t>(in);
+		for (size_t j = 0; j < numReads; ++j)
+		{
+			exInfo.reads.push_back(Ckpt::readId(in));
+		}
+		exInfo.leftTip = Ckpt::readValue<uint8_t>(in);
+		exInfo.rightTip = Ckpt::readValue<uint8_t>(in);
+		exInfo.numSuspicious = Ckpt::readValue<int32_t>(in);
+		exInfo.meanOverlaps = Ckpt::readValue<int32_t>(in);
+		exInfo.stepsToTurn = Ckpt::readValue<int32_t>(in);
+		exInfo.assembledLength = Ckpt::readValue<int32_t>(in);
+		exInfo.singleton = Ckpt::readValue<uint8_t>(in);
+		exInfo.avgOverlapSize = Ckpt::readValue<int32_t>(in);
+		exInfo.minOverlapSize = Ckpt::readValue<int32_t>(in);
+		exInfo.shortExtensions = Ckpt::readValue<int32_t>(in);
+		_readLists.push_back(std::move(exInfo));
+	}
+
+	for (ReadSet* readSet : {&_innerReads, &coveredReads, &processedReads})
+	{
+		readSet->clear();
+		size_t numReads = Ckpt::readValue<uint64_t>(in);
+		for (size_t i = 0; i < numReads; ++i)
+		{
+			readSet->insert(Ckpt::readId(in), true);
+		}
+	}
+	Logger::get().debug() << "Restored " << _readLists.size() << " disjointigs, "
+		<< processedReads.size() << " processed reads";
+}
+
 std::vector<FastaRecord::Id> 
 	Extender::getInnerReads(const std::vector<OverlapRange>& ovlps)
 {
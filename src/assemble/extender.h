@@ -10,6 +10,7 @@
 #include "../sequence/overlap.h"
 #include "../sequence/consensus_generator.h"
 #include "chimera.h"
+#include "checkpoint.h"
 
 class Extender
 {
@@ -20,12 +21,19 @@ public:
 		_safeOverlap(safeOverlap),
 		_readsContainer(readsContainer), 
 		_ovlpContainer(ovlpContainer),
-		_chimDetector(readsContainer, ovlpContainer)
+		_chimDetector(readsContainer, ovlpContainer),
+		_checkpoint(nullptr)
 	{}
 
 	void assembleDisjointigs();
+	//if set, the extension progress is periodically saved
+	//and restored from the checkpoint
+	void setCheckpoint(AssemblyCheckpoint* checkpoint) 
+		{_checkpoint = checkpoint;}
 	const std::vector<ContigPath>& getDisjointigPaths() const
 		{return _disjointigPaths;}
+	std::vector<ContigPath>& getDisjointigPaths()
+		{return _disjointigPaths;}
 
 private:
 	struct ExtensionInfo
@@ -35,7 +43,7 @@ private:
 			assembledLength(0), singleton(false),
 			avgOverlapSize(0), minOverlapSize(0),
 			//leftAsmOverlap(0), rightAsmOverlap(0),
-			shortExtensions(0) {}
+			shortExtensions(0), aborted(false) {}
 
 		std::vector<FastaRecord::Id> reads;
 		bool leftTip;
@@ -50,11 +58,27 @@ private:
 		//int  leftAsmOverlap;
 		//int  rightAsmOverlap;
 		int  shortExtensions;
+		//stopped because of the higher priority extension
+		bool aborted;
 	};
 
 	const int _safeOverlap;
 
-	ExtensionInfo extendDisjointig(FastaRecord::Id startingRead);
+	//reads that were looked up in the inner reads index, and
+	//were not inner at that time. Used to validate the speculative
+	//extensions in the deterministic mode
+	typedef std::vector<FastaRecord::Id> InnerLookups;
+	bool isInnerRead(FastaRecord::Id readId, InnerLookups* innerLookups);
+
+	//reads are claimed by the extensions in progress. A read claimed by
+	//an extension with a higher priority (lower ticket) can not be claimed,
+	//otherwise the claim is taken over. Zero ticket disables claiming
+	bool claimRead(FastaRecord::Id readId, size_t ticket);
+	void releaseClaims(const ExtensionInfo& exInfo, size_t ticket);
+
+	ExtensionInfo extendDisjointig(FastaRecord::Id startingRead,
+								   InnerLookups* innerLookups = nullptr,
+								   size_t claimTicket = 0);
 	//int   countRightExtensions(FastaRecord::Id readId) const;
 	int   countRightExtensions(const std::vector<OverlapRange>&) const;
 	int   countLeftExtensions(const std::vector<OverlapRange>&) const;
@@ -64,6 +88,12 @@ private:
 	std::vector<FastaRecord::Id> 
 		getInnerReads(const std::vector<OverlapRange>& ovlps);
 
+	typedef cuckoohash_map<FastaRecord::Id, size_t> ReadSet;
+	void saveSnapshot(std::ostream& out, ReadSet& coveredReads, 
+					  ReadSet& processedReads);
+	void loadSnapshot(std::istream& in, ReadSet& coveredReads, 
+					  ReadSet& processedReads);
+
 	const SequenceContainer& _readsContainer;
 	OverlapContainer& _ovlpContainer;
 	ChimeraDetector   _chimDetector;
@@ -71,4 +101,6 @@ private:
 	std::vector<ExtensionInfo> 	_readLists;
 	std::vector<ContigPath> 	_disjointigPaths;
 	cuckoohash_map<FastaRecord::Id, size_t>  	_innerReads;
+	cuckoohash_map<FastaRecord::Id, size_t>  	_claimedReads;
+	AssemblyCheckpoint* _checkpoint;
 };
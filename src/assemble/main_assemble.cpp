@@ -8,6 +8,7 @@
 #include <unistd.h>
 #include <cmath>
 #include <execinfo.h>
+#include <sys/stat.h>
 
 #include "../sequence/vertex_index.h"
 #include "../sequence/sequence_container.h"
@@ -16,9 +17,13 @@
 #include "../common/config.h"
 #include "../assemble/extender.h"
 #include "../assemble/parameters_estimator.h"
+#include "../assemble/checkpoint.h"
 #include "../common/logger.h"
 #include "../common/utils.h"
 #include "../common/memory_info.h"
+#include "../common/memory_budget.h"
+#include "../common/arena_allocator.h"
+#include "../common/profiler.h"
 
 #include <getopt.h>
 
@@ -26,14 +31,16 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 			   std::string& outAssembly, std::string& logFile, size_t& genomeSize,
 			   int& kmerSize, bool& debug, size_t& numThreads, int& minOverlap, 
 			   std::string& configPath, int& minReadLength, bool& unevenCov, 
-			   std::string& extraParams)
+			   std::string& extraParams, size_t& memoryLimit,
+			   std::string& checkpointDir, bool& resume, bool& deterministic)
 {
 	auto printUsage = []()
 	{
 		std::cerr << "Usage: flye-assemble "
 				  << " --reads path --out-asm path --config path [--genome-size size]\n"
 				  << "\t\t[--min-read length] [--log path] [--treads num] [--extra-params]\n"
-				  << "\t\t[--kmer size] [--meta] [--min-ovlp size] [--debug] [-h]\n\n"
+				  << "\t\t[--kmer size] [--meta] [--min-ovlp size] [--debug] [-h]\n"
+				  << "\t\t[--checkpoint-dir path] [--resume] [--deterministic]\n\n"
 				  << "Required arguments:\n"
 				  << "  --reads path\tcomma-separated list of read files\n"
 				  << "  --out-asm path\tpath to output file\n"
@@ -51,6 +58,14 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 				  << "[default = not set] \n"
 				  << "  --log log_file\toutput log to file "
 				  << "[default = not set] \n"
+				  << "  --checkpoint-dir path\tsave intermediate results to "
+				  << "the directory [default = not set] \n"
+				  << "  --resume \t\tcontinue from the saved checkpoints "
+				  << "[default = false] \n"
+				  << "  --deterministic \tsame results for any number of threads "
+				  << "[default = false] \n"
+				  << "  --memory-limit bytes\tmemory budget "
+				  << "[default = available RAM] \n"
 				  << "  --threads num_threads\tnumber of parallel threads "
 				  << "[default = 1] \n";
 	};
@@ -68,6 +83,10 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 		{"kmer", required_argument, 0, 0},
 		{"min-ovlp", required_argument, 0, 0},
 		{"extra-params", required_argument, 0, 0},
+		{"memory-limit", required_argument, 0, 0},
+		{"checkpoint-dir", required_argument, 0, 0},
+		{"resume", no_argument, 0, 0},
+		{"deterministic", no_argument, 0, 0},
 		{"meta", no_argument, 0, 0},
 		{"debug", no_argument, 0, 0},
 		{0, 0, 0, 0}
@@ -103,6 +122,14 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 				configPath = optarg;
 			else if (!strcmp(longOptions[optionIndex].name, "extra-params"))
 				extraParams = optarg;
+			else if (!strcmp(longOptions[optionIndex].name, "memory-limit"))
+				memoryLimit = atoll(optarg);
+			else if (!strcmp(longOptions[optionIndex].name, "checkpoint-dir"))
+				checkpointDir = optarg;
+			else if (!strcmp(longOptions[optionIndex].name, "resume"))
+				resume = true;
+			else if (!strcmp(longOptions[optionIndex].name, "deterministic"))
+				deterministic = true;
 			break;
 
 		case 'h':
@@ -139,13 +166,20 @@ int assemble_main(int argc, char** argv)
 	std::string logFile;
 	std::string configPath;
 	std::string extraParams;
+	size_t memoryLimit = 0;
+	std::string checkpointDir;
+	bool resume = false;
+	bool deterministic = false;
 
 	if (!parseArgs(argc, argv, readsFasta, outAssembly, logFile, genomeSize,
 				   kmerSize, debugging, numThreads, minOverlap, configPath, 
-				   minReadLength, unevenCov, extraParams)) return 1;
+				   minReadLength, unevenCov, extraParams, memoryLimit,
+				   checkpointDir, resume, deterministic)) return 1;
 
 	Logger::get().setDebugging(debugging);
 	if (!logFile.empty()) Logger::get().setOutputFile(logFile);
+	if (!logFile.empty()) Profiler::get().setOutputFileNear(logFile);
+	Profiler::ScopedPhase modulePhase("assemble");
 	Logger::get().debug() << "Build date: " << __DATE__ << " " << __TIME__;
 	std::ios::sync_with_stdio(false);
 
@@ -154,6 +188,8 @@ int assemble_main(int argc, char** argv)
 	Logger::get().debug() << "Available RAM: " 
 		<< getFreeMemorySize() / 1024 / 1024 / 1024 << " Gb";
 	Logger::get().debug() << "Total CPUs: " << std::thread::hardware_concurrency();
+	MemoryBudget::get().setLimit(memoryLimit);
+	MemoryBudget::get().logStatus();
 
 	Config::load(configPath);
 	if (!extraParams.empty()) Config::addParameters(extraParams);
@@ -162,36 +198,69 @@ int assemble_main(int argc, char** argv)
 		kmerSize = Config::get("kmer_size");
 	}
 	Parameters::get().numThreads = numThreads;
+	MemoryArena::get().configure(Config::get("huge_pages"),
+								 Config::get("numa_placement"), numThreads);
 	Parameters::get().kmerSize = kmerSize;
 	Parameters::get().minimumOverlap = minOverlap;
 	Parameters::get().unevenCoverage = unevenCov;
+	Parameters::get().deterministic = deterministic;
 	Logger::get().debug() << "Running with k-mer size: " << 
 		Parameters::get().kmerSize; 
 	Logger::get().debug() << "Running with minimum overlap " << minOverlap;
 	Logger::get().debug() << "Metagenome mode: " << "NY"[unevenCov];
+	Logger::get().debug() << "Deterministic mode: " << "NY"[deterministic];
 
 	//TODO: unify minimumOverlap ad safeOverlap concepts
 	Parameters::get().minimumOverlap = 1000;
 
-	SequenceContainer readsContainer;
+	//only use reads that are longer than minOverlap,
+	//or a specified threshold (used for downsampling)
+	minReadLength = std::max(minReadLength, minOverlap);
 	std::vector<std::string> readsList = splitString(readsFasta, ',');
-	Logger::get().info() << "Reading sequences";
-	try
+
+	//checkpoints are only valid for the same input and parameters
+	AssemblyCheckpoint checkpoint;
+	if (!checkpointDir.empty())
 	{
-		//only use reads that are longer than minOverlap,
-		//or a specified threshold (used for downsampling)
-		minReadLength = std::max(minReadLength, minOverlap);
+		std::string fingerprint = configPath + ";" + extraParams + ";" +
+			std::to_string(kmerSize) + ";" + std::to_string(minReadLength) + ";" +
+			std::to_string(unevenCov) + ";" + std::to_string(deterministic);
 		for (auto& readsFile : readsList)
 		{
-			readsContainer.loadFromFile(readsFile, minReadLength);
+			struct stat fileStat;
+			size_t fileSize = !stat(readsFile.c_str(), &fileStat) ? 
+							  fileStat.st_size : 0;
+			fingerprint += ";" + readsFile + ":" + std::to_string(fileSize);
 		}
+		checkpoint.init(checkpointDir, fingerprint, resume);
 	}
-	catch (SequenceContainer::ParseException& e)
+
+	Profiler::ScopedPhase stagePhase("read_loading");
+	SequenceContainer readsContainer;
+	auto loadReads = [&readsContainer](std::istream& in)
+		{AssemblyCheckpoint::loadReads(readsContainer, in);};
+	if (!checkpoint.load("reads", loadReads))
 	{
-		Logger::get().error() << e.what();
-		return 1;
+		Logger::get().info() << "Reading sequences";
+		try
+		{
+			for (auto& readsFile : readsList)
+			{
+				readsContainer.loadFromFile(readsFile, minReadLength);
+			}
+		}
+		catch (SequenceContainer::ParseException& e)
+		{
+			Logger::get().error() << e.what();
+			return 1;
+		}
+		checkpoint.save("reads", [&readsContainer](std::ostream& out)
+			{AssemblyCheckpoint::saveReads(readsContainer, out);});
 	}
 	readsContainer.buildPositionIndex();
+	Profiler::count("reads", readsContainer.iterSeqs().size() / 2);
+
+	stagePhase.switchTo("kmer_index");
 	VertexIndex vertexIndex(readsContainer, 
 							(int)Config::get("assemble_kmer_sample"));
 	vertexIndex.outputProgress(true);
@@ -209,22 +278,30 @@ int assemble_main(int argc, char** argv)
 	static const int TANDEM_FREQ = Config::get("meta_read_filter_kmer_freq");
 
 	//Building index
-	bool useMinimizers = Config::get("use_minimizers");
-	if (useMinimizers)
-	{
-		const int minWnd = Config::get("minimizer_window");
-		vertexIndex.buildIndexMinimizers(/*min freq*/ 1, minWnd);
-	}
-	else	//indexing using solid k-mers
+	auto loadIndex = [&vertexIndex](std::istream& in)
+		{vertexIndex.loadIndex(in);};
+	if (!checkpoint.load("index", loadIndex))
 	{
-		vertexIndex.countKmers();
-		vertexIndex.buildIndexUnevenCoverage(MIN_FREQ, SELECT_RATE, 
-											 TANDEM_FREQ);
+		bool useMinimizers = Config::get("use_minimizers");
+		if (useMinimizers)
+		{
+			const int minWnd = Config::get("minimizer_window");
+			vertexIndex.buildIndexMinimizers(/*min freq*/ 1, minWnd);
+		}
+		else	//indexing using solid k-mers
+		{
+			vertexIndex.countKmers();
+			vertexIndex.buildIndexUnevenCoverage(MIN_FREQ, SELECT_RATE, 
+												 TANDEM_FREQ);
+		}
+		checkpoint.save("index", [&vertexIndex](std::ostream& out)
+			{vertexIndex.saveIndex(out);});
 	}
 
 	Logger::get().debug() << "Peak RAM usage: " 
 		<< getPeakRSS() / 1024 / 1024 / 1024 << " Gb";
 
+	stagePhase.switchTo("disjointig_extension");
 	//int maxOverlapsNum = !Parameters::get().unevenCoverage ? 5 * coverage : 0;
 	OverlapDetector ovlp(readsContainer, vertexIndex,
 						 (int)Config::get("maximum_jump"), 
@@ -237,18 +314,28 @@ int assemble_main(int argc, char** argv)
 						 /*partition bad map*/ false,
 						 (bool)Config::get("hpc_scoring_on"));
 	OverlapContainer readOverlaps(ovlp, readsContainer);
-	readOverlaps.estimateOverlaperParameters();
+	auto loadOvlpParams = [&readOverlaps](std::istream& in)
+		{readOverlaps.setMeanTrueDivergence(AssemblyCheckpoint::readValue<float>(in));};
+	if (!checkpoint.load("overlap_params", loadOvlpParams))
+	{
+		readOverlaps.estimateOverlaperParameters();
+		checkpoint.save("overlap_params", [&readOverlaps](std::ostream& out)
+			{AssemblyCheckpoint::writeValue<float>(out, 
+									readOverlaps.getMeanTrueDivergence());});
+	}
 	readOverlaps.setDivergenceThreshold((float)Config::get("assemble_ovlp_divergence"),
 										(bool)Config::get("assemble_divergence_relative"));
 
 	Extender extender(readsContainer, readOverlaps, minOverlap);
+	if (checkpoint.enabled()) extender.setCheckpoint(&checkpoint);
 	extender.assembleDisjointigs();
 	vertexIndex.clear();
+	Profiler::count("disjointigs", extender.getDisjointigPaths().size());
 
+	stagePhase.switchTo("consensus");
 	ConsensusGenerator consGen;
-	auto disjointigsFasta = 
-		consGen.generateConsensuses(extender.getDisjointigPaths());
-	SequenceContainer::writeFasta(disjointigsFasta, outAssembly);
+	consGen.streamConsensuses(extender.getDisjointigPaths(), outAssembly);
+	checkpoint.clear();
 
 	Logger::get().debug() << "Peak RAM usage: " 
 		<< getPeakRSS() / 1024 / 1024 / 1024 << " Gb";
@@ -0,0 +1,450 @@
+//(c) 2016-2020 by Authors
+//This file is a part of Flye program.
+//Released under the BSD license (see LICENSE file)
+
+//Microbenchmarks for the core kernels. All input data is synthetic,
+//so the benchmarks could be run offline and compared between releases
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <cstring>
+#include <getopt.h>
+
+#include "../sequence/sequence_container.h"
+#include "../sequence/vertex_index.h"
+#include "../sequence/overlap.h"
+#include "../sequence/alignment.h"
+#include "../sequence/kmer.h"
+#include "../common/config.h"
+#include "../common/logger.h"
+#include "../polishing/alignment.h"
+#include "../polishing/homo_polisher.h"
+#include "../polishing/subs_matrix.h"
+#include "synthetic.h"
+
+namespace
+{
+	struct BenchOptions
+	{
+		BenchOptions():
+			genomeLength(200000), readLength(10000), numReads(100),
+			errorRate(0.1f), repeatFraction(0.05f), kmerSize(15),
+			numThreads(1), seed(42), minTime(1.0f)
+		{}
+
+		size_t genomeLength;
+		size_t readLength;
+		size_t numReads;
+		float  errorRate;
+		float  repeatFraction;
+		int    kmerSize;
+		size_t numThreads;
+		int    seed;
+		float  minTime;
+		std::string filter;
+		std::string subsMatrix;
+		std::string hopoMatrix;
+	};
+
+	bool parseArgs(int argc, char** argv, BenchOptions& opts)
+	{
+		auto printUsage = []()
+		{
+			std::cerr << "Usage: flye-bench [--filter name] [--genome-len len] "
+					  << "[--read-len len]\n\t\t[--reads num] [--error-rate rate] "
+					  << "[--repeat-fraction rate] [--kmer size]\n\t\t[--threads num] "
+					  << "[--seed seed] [--min-time sec]\n\t\t[--subs-mat path] "
+					  << "[--hopo-mat path] [-h]\n\n"
+					  << "Optional arguments:\n"
+					  << "  --filter name\trun only benchmarks containing the substring "
+					  << "[default = all] \n"
+					  << "  --genome-len len\tsynthetic genome length [default = 200000] \n"
+					  << "  --read-len len\tsynthetic read length, up to the genome length "
+					  << "[default = 10000] \n"
+					  << "  --reads num\tnumber of synthetic reads [default = 100] \n"
+					  << "  --error-rate rate\tread error rate [default = 0.1] \n"
+					  << "  --repeat-fraction rate\tfraction of the genome covered by "
+					  << "repeats [default = 0.05] \n"
+					  << "  --kmer size\tk-mer size, up to 32 [default = 15] \n"
+					  << "  --threads num\tnumber of parallel threads [default = 1] \n"
+					  << "  --seed seed\trandom seed [default = 42] \n"
+					  << "  --min-time sec\tminimum running time of each benchmark "
+					  << "[default = 1.0] \n"
+					  << "  --subs-mat path\tpolisher substitution matrix, "
+					  << "polisher benchmarks are skipped if not set\n"
+					  << "  --hopo-mat path\tpolisher homopolymer matrix, "
+					  << "homopolymer benchmark is skipped if not set\n";
+		};
+
+		int optionIndex = 0;
+		static option longOptions[] =
+		{
+			{"filter", required_argument, 0, 0},
+			{"genome-len", required_argument, 0, 0},
+			{"read-len", required_argument, 0, 0},
+			{"reads", required_argument, 0, 0},
+			{"error-rate", required_argument, 0, 0},
+			{"repeat-fraction", required_argument, 0, 0},
+			{"kmer", required_argument, 0, 0},
+			{"threads", required_argument, 0, 0},
+			{"seed", required_argument, 0, 0},
+			{"min-time", required_argument, 0, 0},
+			{"subs-mat", required_argument, 0, 0},
+			{"hopo-mat", required_argument, 0, 0},
+			{0, 0, 0, 0}
+		};
+
+		int opt = 0;
+		while ((opt = getopt_long(argc, argv, "h", longOptions, &optionIndex)) != -1)
+		{
+			switch(opt)
+			{
+			case 0:
+				if (!strcmp(longOptions[optionIndex].name, "filter"))
+					opts.filter = optarg;
+				else if (!strcmp(longOptions[optionIndex].name, "genome-len"))
+					opts.genomeLength = atoll(optarg);
+				else if (!strcmp(longOptions[optionIndex].name, "read-len"))
+					opts.readLength = atoll(optarg);
+				else if (!strcmp(longOptions[optionIndex].name, "reads"))
+					opts.numReads = atoll(optarg);
+				else if (!strcmp(longOptions[optionIndex].name, "error-rate"))
+					opts.errorRate = atof(optarg);
+				else if (!strcmp(longOptions[optionIndex].name, "repeat-fraction"))
+					opts.repeatFraction = atof(optarg);
+				else if (!strcmp(longOptions[optionIndex].name, "kmer"))
+					opts.kmerSize = atoi(optarg);
+				else if (!strcmp(longOptions[optionIndex].name, "threads"))
+					opts.numThreads = atoi(optarg);
+				else if (!strcmp(longOptions[optionIndex].name, "seed"))
+					opts.seed = atoi(optarg);
+				else if (!strcmp(longOptions[optionIndex].name, "min-time"))
+					opts.minTime = atof(optarg);
+				else if (!strcmp(longOptions[optionIndex].name, "subs-mat"))
+					opts.subsMatrix = optarg;
+				else if (!strcmp(longOptions[optionIndex].name, "hopo-mat"))
+					opts.hopoMatrix = optarg;
+				break;
+
+			case 'h':
+				printUsage();
+				exit(0);
+
+			default:
+				printUsage();
+				return false;
+			}
+		}
+		//the benchmarks are made for the regular 64-bit k-mers
+		if (opts.kmerSize < 1 || (size_t)opts.kmerSize > Kmer::MAX_SIZE)
+		{
+			std::cerr << "k-mer size should be between 1 and " 
+				<< Kmer::MAX_SIZE << std::endl;
+			return false;
+		}
+		//reads and aligned pairs are sampled from the genome
+		if (opts.readLength < 1 || opts.genomeLength < opts.readLength)
+		{
+			std::cerr << "read length should be between 1 and the genome length ("
+				<< opts.genomeLength << ")" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	class BenchRunner
+	{
+	public:
+		BenchRunner(const BenchOptions& opts): _opts(opts)
+		{
+			std::cout << std::left << std::setw(28) << "benchmark"
+				<< std::right << std::setw(8) << "iters"
+				<< std::setw(14) << "ms/iter" << std::setw(16) << "units/sec"
+				<< "  units" << std::endl;
+		}
+
+		bool selected(const std::string& name) const
+		{
+			return _opts.filter.empty() || 
+				   name.find(_opts.filter) != std::string::npos;
+		}
+
+		//runs the function until minTime is reached. Function returns
+		//the number of processed units (e.g. bases or alignments)
+		void run(const std::string& name, const std::string& unitName,
+				 std::function<size_t()> benchFun)
+		{
+			if (!this->selected(name)) return;
+
+			size_t iterations = 0;
+			size_t totalUnits = 0;
+			double elapsed = 0;
+			auto timeStart = std::chrono::steady_clock::now();
+			while (iterations == 0 || elapsed < _opts.minTime)
+			{
+				totalUnits += benchFun();
+				++iterations;
+				elapsed = std::chrono::duration<double>
+					(std::chrono::steady_clock::now() - timeStart).count();
+			}
+
+			std::cout << std::left << std::setw(28) << name
+				<< std::right << std::setw(8) << iterations
+				<< std::fixed << std::setprecision(3)
+				<< std::setw(14) << elapsed * 1000 / iterations
+				<< std::setprecision(0) << std::setw(16) << totalUnits / elapsed
+				<< "  " << unitName << std::endl;
+		}
+
+	private:
+		const BenchOptions& _opts;
+	};
+
+	//prevents the compiler from optimizing away the computed value
+	volatile size_t g_sink = 0;
+
+	//synthetic polishing bubble: candidate and the erroneous branches
+	Bubble makeBubble(SyntheticGenerator& gen, size_t length,
+					  size_t numBranches, float errorRate)
+	{
+		Bubble bubble;
+		bubble.header = "bench";
+		bubble.position = 0;
+		//homopolymers are the main source of errors in polishing,
+		//so the sequence is generated as a series of short runs
+		std::string truth;
+		while (truth.length() < length)
+		{
+			char nucl = gen.randomSequence(1)[0];
+			if (!truth.empty() && truth.back() == nucl) continue;
+			truth += std::string(1 + gen.random(5), nucl);
+		}
+		bubble.candidate = gen.mutate(truth, errorRate / 2);
+		for (size_t i = 0; i < numBranches; ++i)
+		{
+			bubble.branches.push_back(gen.mutate(truth, errorRate));
+		}
+		return bubble;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	BenchOptions opts;
+	if (!parseArgs(argc, argv, opts)) return 1;
+
+	Parameters::get().kmerSize = opts.kmerSize;
+	Parameters::get().numThreads = opts.numThreads;
+	Parameters::get().minimumOverlap = 1000;
+	Parameters::get().unevenCoverage = false;
+	Config::addParameters("repeat_kmer_rate=100");
+
+	SyntheticGenerator gen(opts.seed);
+	std::string genome = gen.randomGenome(opts.genomeLength, opts.repeatFraction);
+	SequenceContainer reads;
+	size_t readNum = 0;
+	for (auto& readStr : gen.sampleReads(genome, opts.numReads,
+										 opts.readLength, opts.errorRate))
+	{
+		reads.addSequence(DnaSequence(readStr), "read_" + std::to_string(readNum++));
+	}
+	reads.buildPositionIndex();
+	size_t totalBases = 0;
+	for (auto& rec : reads.iterSeqs())
+	{
+		if (rec.id.strand()) totalBases += rec.sequence.length();
+	}
+
+	BenchRunner runner(opts);
+
+	//k-mer iteration and minimizers
+	runner.run("kmer_iteration", "kmers", [&reads]()
+	{
+		size_t numKmers = 0;
+		size_t hashSum = 0;
+		for (auto& rec : reads.iterSeqs())
+		{
+			for (auto kmerPos : IterKmers(rec.sequence))
+			{
+				kmerPos.kmer.standardForm();
+				hashSum += kmerPos.kmer.hash();
+				++numKmers;
+			}
+		}
+		g_sink += hashSum;
+		return numKmers;
+	});
+	runner.run("minimizers_w5", "bases", [&reads]()
+	{
+		size_t numBases = 0;
+		for (auto& rec : reads.iterSeqs())
+		{
+			g_sink += yieldMinimizers(rec.sequence, /*window*/ 5).size();
+			numBases += rec.sequence.length();
+		}
+		return numBases;
+	});
+
+	//vertex index
+	runner.run("vertex_index_solid", "bases", [&reads, totalBases]()
+	{
+		VertexIndex index(reads, /*sample rate*/ 1);
+		index.outputProgress(false);
+		index.countKmers();
+		index.buildIndexUnevenCoverage(/*min freq*/ 2, /*select rate*/ 0.4f,
+									   /*tandem freq*/ 100);
+		return totalBases;
+	});
+	runner.run("vertex_index_minimizers", "bases", [&reads, totalBases]()
+	{
+		VertexIndex index(reads, /*sample rate*/ 1);
+		index.buildIndexMinimizers(/*min freq*/ 1, /*window*/ 5);
+		return totalBases;
+	});
+
+	VertexIndex solidIndex(reads, /*sample rate*/ 1);
+	solidIndex.outputProgress(false);
+	if (runner.selected("vertex_index_lookup") || runner.selected("overlaps"))
+	{
+		solidIndex.countKmers();
+		solidIndex.buildIndexUnevenCoverage(2, 0.4f, 100);
+	}
+	runner.run("vertex_index_lookup", "kmers", [&reads, &solidIndex]()
+	{
+		size_t numKmers = 0;
+		size_t numPositions = 0;
+		for (auto& rec : reads.iterSeqs())
+		{
+			for (auto kmerPos : IterKmers(rec.sequence))
+			{
+				++numKmers;
+				for (const auto& readPos : 
+					 solidIndex.shortIndex().lookupKmer(kmerPos.kmer).positions)
+				{
+					numPositions += readPos.position;
+				}
+			}
+		}
+		g_sink += numPositions;
+		return numKmers;
+	});
+
+	//overlap detection
+	OverlapDetector ovlpDetector(reads, solidIndex, /*max jump*/ 1500,
+								 /*min overlap*/ 1000, /*max overhang*/ 1500,
+								 /*store alignment*/ false, /*only max*/ true,
+								 /*max divergence*/ 1.0f, /*nucl alignment*/ false,
+								 /*partition bad map*/ false, /*use hpc*/ false);
+	OverlapContainer ovlpContainer(ovlpDetector, reads);
+	runner.run("overlaps", "reads", [&reads, &ovlpContainer]()
+	{
+		size_t numReads = 0;
+		for (auto& rec : reads.iterSeqs())
+		{
+			if (!rec.id.strand()) continue;
+			g_sink += ovlpContainer.quickSeqOverlaps(rec.id).size();
+			++numReads;
+		}
+		return numReads;
+	});
+
+	//pairwise alignment kernels on true overlapping read pairs
+	const size_t ALN_LEN = std::min((size_t)5000, opts.readLength);
+	std::vector<std::string> alnSources;
+	for (size_t i = 0; i < 20; ++i)
+	{
+		alnSources.push_back(genome.substr(gen.random(genome.length() - ALN_LEN + 1),
+										   ALN_LEN));
+	}
+	SequenceContainer alnPairs;
+	std::vector<OverlapRange> alnRanges;
+	for (auto& source : alnSources)
+	{
+		//records are copied, since references are invalidated on insertion
+		FastaRecord trg = alnPairs.addSequence(DnaSequence(gen.mutate(source, opts.errorRate)),
+											   "trg_" + std::to_string(alnRanges.size()));
+		FastaRecord qry = alnPairs.addSequence(DnaSequence(gen.mutate(source, opts.errorRate)),
+											   "qry_" + std::to_string(alnRanges.size()));
+		OverlapRange ovlp(trg.id, qry.id, 0, 0, trg.sequence.length(),
+						  qry.sequence.length());
+		ovlp.curEnd = trg.sequence.length();
+		ovlp.extEnd = qry.sequence.length();
+		alnRanges.push_back(ovlp);
+	}
+	runner.run("align_cigar_ksw", "alignments", [&alnPairs, &alnRanges]()
+	{
+		std::vector<CigOp> cigar;
+		for (auto& ovlp : alnRanges)
+		{
+			getAlignmentCigarKsw(alnPairs.getSeq(ovlp.curId), 0, ovlp.curRange(),
+								 alnPairs.getSeq(ovlp.extId), 0, ovlp.extRange(),
+								 /*max err*/ 1.0f, cigar);
+			g_sink += cigar.size();
+		}
+		return alnRanges.size();
+	});
+	runner.run("align_err_edlib", "alignments", [&alnPairs, &alnRanges, &opts]()
+	{
+		for (auto& ovlp : alnRanges)
+		{
+			g_sink += 1000 * getAlignmentErrEdlib(ovlp, alnPairs.getSeq(ovlp.curId),
+												  alnPairs.getSeq(ovlp.extId),
+												  2 * opts.errorRate, /*hpc*/ false);
+		}
+		return alnRanges.size();
+	});
+	runner.run("check_idy_trim", "alignments", [&alnPairs, &alnRanges, &opts]()
+	{
+		for (auto& ovlp : alnRanges)
+		{
+			OverlapRange ovlpCopy = ovlp;
+			//threshold below the pairwise error rate, so the alignments
+			//are split into multiple intervals
+			g_sink += checkIdyAndTrim(ovlpCopy, alnPairs.getSeq(ovlp.curId),
+									  alnPairs.getSeq(ovlp.extId), opts.errorRate,
+									  /*min overlap*/ 500, /*hpc*/ false).size();
+		}
+		return alnRanges.size();
+	});
+
+	//polisher
+	if (!opts.subsMatrix.empty())
+	{
+		SubstitutionMatrix subsMatrix(opts.subsMatrix);
+		std::vector<Bubble> bubbles;
+		for (size_t i = 0; i < 20; ++i)
+		{
+			bubbles.push_back(makeBubble(gen, /*length*/ 100, /*branches*/ 30,
+										 opts.errorRate));
+		}
+
+		runner.run("polish_global_alignment", "bubbles", [&bubbles, &subsMatrix]()
+		{
+			for (auto& bubble : bubbles)
+			{
+				Alignment align(bubble.branches.size(), subsMatrix);
+				g_sink += align.globalAlignment(bubble.candidate, bubble.branches);
+			}
+			return bubbles.size();
+		});
+
+		if (!opts.hopoMatrix.empty())
+		{
+			HopoMatrix hopoMatrix(opts.hopoMatrix);
+			HomoPolisher homoPolisher(subsMatrix, hopoMatrix);
+			runner.run("polish_homopolymers", "bubbles", [&bubbles, &homoPolisher]()
+			{
+				for (auto bubble : bubbles)
+				{
+					homoPolisher.polishBubble(bubble);
+					g_sink += bubble.candidate.size();
+				}
+				return bubbles.size();
+			});
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+//(c) 2016-2020 by Authors
+//This file is a part of Flye program.
+//Released under the BSD license (see LICENSE file)
+
+//Generators of synthetic genomes and reads, so the benchmarks
+//do not depend on any external data
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+class SyntheticGenerator
+{
+public:
+	explicit SyntheticGenerator(int seed): _rng(seed) {}
+
+	std::string randomSequence(size_t length)
+	{
+		std::string seq(length, 'A');
+		for (auto& nucl : seq) nucl = "ACGT"[_rng() % 4];
+		return seq;
+	}
+
+	//random genome in which repeatFraction of the sequence is covered
+	//by (exact) copies of a few repeat units of the given length
+	std::string randomGenome(size_t length, float repeatFraction,
+							 size_t repeatLength = 5000)
+	{
+		std::string genome = this->randomSequence(length);
+		size_t numCopies = length * repeatFraction / repeatLength;
+		if (!numCopies || repeatLength >= length) return genome;
+
+		const size_t NUM_UNITS = 3;
+		std::vector<std::string> units;
+		for (size_t i = 0; i < NUM_UNITS; ++i)
+		{
+			units.push_back(this->randomSequence(repeatLength));
+		}
+		for (size_t i = 0; i < numCopies; ++i)
+		{
+			size_t pos = _rng() % (length - repeatLength);
+			genome.replace(pos, repeatLength, units[i % NUM_UNITS]);
+		}
+		return genome;
+	}
+
+	//introduces substitutions, insertions and deletions with equal
+	//probabilities, so that the total error rate is errorRate
+	std::string mutate(const std::string& seq, float errorRate)
+	{
+		std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+		std::string mutated;
+		mutated.reserve(seq.length() * (1 + errorRate));
+		for (char nucl : seq)
+		{
+			float roll = dist(_rng);
+			if (roll >= errorRate)
+			{
+				mutated += nucl;
+			}
+			else if (roll < errorRate / 3)			//substitution
+			{
+				mutated += "ACGT"[(this->nuclId(nucl) + 1 + _rng() % 3) % 4];
+			}
+			else if (roll < errorRate * 2 / 3)		//insertion
+			{
+				mutated += nucl;
+				mutated += "ACGT"[_rng() % 4];
+			}
+			//else - deletion
+		}
+		return mutated;
+	}
+
+	std::string reverseComplement(const std::string& seq)
+	{
+		std::string revComp(seq.rbegin(), seq.rend());
+		for (auto& nucl : revComp) nucl = "TGCA"[this->nuclId(nucl)];
+		return revComp;
+	}
+
+	//reads of the fixed length sampled uniformly from both strands
+	std::vector<std::string> sampleReads(const std::string& genome, size_t numReads,
+										 size_t readLength, float errorRate)
+	{
+		readLength = std::min(readLength, genome.length());
+		std::vector<std::string> reads;
+		for (size_t i = 0; i < numReads; ++i)
+		{
+			size_t start = _rng() % (genome.length() - readLength + 1);
+			std::string read = genome.substr(start, readLength);
+			if (_rng() % 2) read = this->reverseComplement(read);
+			reads.push_back(this->mutate(read, errorRate));
+		}
+		return reads;
+	}
+
+	size_t random(size_t max) {return _rng() % max;}
+
+private:
+	static size_t nuclId(char nucl)
+	{
+		switch (nucl)
+		{
+			case 'A': return 0;
+			case 'C': return 1;
+			case 'G': return 2;
+			default: return 3;
+		}
+	}
+
+	std::mt19937 _rng;
+};
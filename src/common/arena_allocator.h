@@ -0,0 +1,309 @@
+//(c) 2016-2020 by Authors
+//This file is a part of Flye program.
+//Released under the BSD license (see LICENSE file)
+
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "memory_info.h"
+#include "logger.h"
+
+//Arena for the largest arrays that are randomly accessed by all threads
+//(k-mer index chunks and read sequences). The memory is mapped directly,
+//so it could be backed by huge pages (transparent or explicit), which
+//reduces TLB misses on random lookups. On multi-socket machines,
+//the pages are either interleaved across the NUMA nodes, or touched
+//in parallel by multiple threads (first-touch policy), so that the
+//arrays are not all placed on the node of the thread that allocated them.
+//
+//There are two kinds of allocations: large regions (released individually
+//with freeRegion) and small packed allocations (reads), which are placed
+//one after another in a reserved address range and are never released.
+//The packed allocations are made through ArenaAllocator, within
+//the MemoryArena::Scope - outside of it, ArenaAllocator is the regular
+//std::allocator, so temporary sequences are not stored in the arena
+class MemoryArena
+{
+public:
+	enum HugePages {HUGE_NONE = 0, HUGE_TRANSPARENT = 1, HUGE_EXPLICIT = 2};
+	enum Placement {PLACE_DEFAULT = 0, PLACE_INTERLEAVE = 1,
+					PLACE_FIRST_TOUCH = 2};
+
+	static MemoryArena& get()
+	{
+		static MemoryArena instance;
+		return instance;
+	}
+
+	//placement is only applied if there are multiple NUMA nodes
+	void configure(int hugePages, int placement, size_t numThreads)
+	{
+		std::lock_guard<std::mutex> lock(_packedMutex);
+		_hugePages = (HugePages)hugePages;
+		_placement = _numNodes > 1 ? (Placement)placement : PLACE_DEFAULT;
+		_numThreads = std::max(numThreads, (size_t)1);
+
+		const char* HUGE_NAMES[] = {"off", "transparent", "explicit"};
+		const char* PLACE_NAMES[] = {"default", "interleaved", "first touch"};
+		Logger::get().debug() << "Memory arena: huge pages "
+			<< HUGE_NAMES[_hugePages] << ", NUMA nodes: " << _numNodes
+			<< ", placement " << PLACE_NAMES[_placement];
+	}
+
+	void* allocateRegion(size_t bytes)
+	{
+		size_t mapSize = roundUp(bytes, HUGE_PAGE);
+		void* ptr = nullptr;
+		if (_hugePages == HUGE_EXPLICIT)
+		{
+			ptr = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE,
+					   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (ptr == MAP_FAILED) ptr = nullptr;
+		}
+		if (!ptr) ptr = this->mapAligned(mapSize);
+		this->placePages(ptr, mapSize);
+		return ptr;
+	}
+
+	void freeRegion(void* ptr, size_t bytes)
+	{
+		if (ptr) munmap(ptr, roundUp(bytes, HUGE_PAGE));
+	}
+
+	//falls back to the regular heap if the reserved range is exhausted
+	void* allocatePacked(size_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(_packedMutex);
+		size_t newTop = roundUp(_packedTop + bytes, CACHE_LINE);
+		if (!_packedBase || newTop > _packedReserved)
+		{
+			return ::operator new(bytes);
+		}
+		while (_packedCommitted < newTop)
+		{
+			this->commitBlock(_packedBase + _packedCommitted);
+			_packedCommitted += PACKED_BLOCK;
+		}
+		void* ptr = _packedBase + _packedTop;
+		_packedTop = newTop;
+		return ptr;
+	}
+
+	bool owns(const void* ptr) const
+	{
+		return (const char*)ptr >= _packedBase &&
+			   (const char*)ptr < _packedBase + _packedReserved;
+	}
+
+	class Scope
+	{
+	public:
+		Scope(): _prevState(inScopeFlag()) {inScopeFlag() = true;}
+		~Scope() {inScopeFlag() = _prevState;}
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	private:
+		bool _prevState;
+	};
+
+	static bool inScope() {return inScopeFlag();}
+
+private:
+	MemoryArena():
+		_hugePages(HUGE_NONE), _placement(PLACE_DEFAULT), _numThreads(1),
+		_numNodes(countNumaNodes()), _packedBase(nullptr),
+		_packedReserved(0), _packedCommitted(0), _packedTop(0)
+	{
+		//only the address space is reserved, the memory is committed
+		//in blocks as the packed allocations grow
+		size_t reserveSize = roundUp(getMemorySize(), PACKED_BLOCK);
+		void* ptr = mmap(nullptr, reserveSize + PACKED_BLOCK, PROT_NONE,
+						 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (ptr != MAP_FAILED)
+		{
+			//aligning to the block, so the blocks could be backed by huge pages
+			char* base = (char*)roundUp((uintptr_t)ptr, PACKED_BLOCK);
+			size_t head = base - (char*)ptr;
+			if (head) munmap(ptr, head);
+			munmap(base + reserveSize, PACKED_BLOCK - head);
+			_packedBase = base;
+			_packedReserved = reserveSize;
+		}
+	}
+	MemoryArena(const MemoryArena&) = delete;
+	MemoryArena& operator=(const MemoryArena&) = delete;
+
+	static bool& inScopeFlag()
+	{
+		static thread_local bool flag = false;
+		return flag;
+	}
+
+	static size_t roundUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	static int countNumaNodes()
+	{
+		DIR* dir = opendir("/sys/devices/system/node");
+		if (!dir) return 1;
+		int numNodes = 0;
+		while (dirent* entry = readdir(dir))
+		{
+			if (!strncmp(entry->d_name, "node", 4) &&
+				isdigit(entry->d_name[4])) ++numNodes;
+		}
+		closedir(dir);
+		return std::max(numNodes, 1);
+	}
+
+	//mmap only guarantees page alignment, so mapping a bit more
+	//and trimming the ends to get huge page alignment
+	void* mapAligned(size_t size)
+	{
+		void* ptr = mmap(nullptr, size + HUGE_PAGE, PROT_READ | PROT_WRITE,
+						 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED) throw std::bad_alloc();
+
+		char* aligned = (char*)roundUp((uintptr_t)ptr, HUGE_PAGE);
+		size_t head = aligned - (char*)ptr;
+		if (head) munmap(ptr, head);
+		munmap(aligned + size, HUGE_PAGE - head);
+		if (_hugePages != HUGE_NONE)
+		{
+			madvise(aligned, size, MADV_HUGEPAGE);
+		}
+		return aligned;
+	}
+
+	void commitBlock(char* ptr)
+	{
+		bool committed = false;
+		if (_hugePages == HUGE_EXPLICIT)
+		{
+			committed = mmap(ptr, PACKED_BLOCK, PROT_READ | PROT_WRITE,
+							 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED |
+							 MAP_HUGETLB, -1, 0) != MAP_FAILED;
+		}
+		//the reserved range is replaced by the new mapping
+		if (!committed)
+		{
+			if (mmap(ptr, PACKED_BLOCK, PROT_READ | PROT_WRITE,
+					 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+			{
+				throw std::bad_alloc();
+			}
+			if (_hugePages != HUGE_NONE)
+			{
+				madvise(ptr, PACKED_BLOCK, MADV_HUGEPAGE);
+			}
+		}
+		this->placePages(ptr, PACKED_BLOCK);
+	}
+
+	//should be called before the pages are touched for the first time
+	void placePages(void* ptr, size_t size)
+	{
+		if (_placement == PLACE_INTERLEAVE)
+		{
+			const int MPOL_INTERLEAVE = 3;
+			const size_t MAX_NODES = sizeof(unsigned long) * 8;
+			unsigned long nodeMask = _numNodes < (int)MAX_NODES ?
+				(1UL << _numNodes) - 1 : ~0UL;
+			syscall(SYS_mbind, ptr, size, MPOL_INTERLEAVE, &nodeMask,
+					MAX_NODES, 0);
+		}
+		else if (_placement == PLACE_FIRST_TOUCH)
+		{
+			//each thread touches every numThreads-th huge page
+			auto touchFn = [ptr, size, this](size_t threadId)
+			{
+				for (size_t offset = threadId * HUGE_PAGE; offset < size;
+					 offset += HUGE_PAGE * _numThreads)
+				{
+					size_t end = std::min(offset + HUGE_PAGE, size);
+					for (size_t page = offset; page < end; page += SMALL_PAGE)
+					{
+						((volatile char*)ptr)[page] = 0;
+					}
+				}
+			};
+			std::vector<std::thread> threads;
+			for (size_t i = 1; i < _numThreads; ++i)
+			{
+				threads.emplace_back(touchFn, i);
+			}
+			touchFn(0);
+			for (auto& thread : threads) thread.join();
+		}
+	}
+
+	static const size_t SMALL_PAGE = 4096;
+	static const size_t HUGE_PAGE = 2 * 1024 * 1024;
+	static const size_t CACHE_LINE = 64;
+	static const size_t PACKED_BLOCK = 64 * 1024 * 1024;
+
+	HugePages _hugePages;
+	Placement _placement;
+	size_t 	  _numThreads;
+	const int _numNodes;
+
+	std::mutex _packedMutex;
+	char*  _packedBase;
+	size_t _packedReserved;
+	size_t _packedCommitted;
+	size_t _packedTop;
+};
+
+//STL allocator that places the data into the MemoryArena
+//if created within the MemoryArena::Scope
+template <class T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+
+	ArenaAllocator() {}
+	template <class U>
+	ArenaAllocator(const ArenaAllocator<U>&) {}
+
+	T* allocate(size_t n)
+	{
+		if (!MemoryArena::inScope()) return std::allocator<T>().allocate(n);
+		return (T*)MemoryArena::get().allocatePacked(n * sizeof(T));
+	}
+
+	void deallocate(T* ptr, size_t n)
+	{
+		if (MemoryArena::get().owns(ptr)) return;
+		std::allocator<T>().deallocate(ptr, n);
+	}
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>&, const ArenaAllocator<U>&)
+{
+	return true;
+}
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>&, const ArenaAllocator<U>&)
+{
+	return false;
+}
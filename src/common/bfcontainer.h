@@ -15,6 +15,8 @@
 #include <vector>
 #include <mutex>
 
+#include "memory_budget.h"
+
 template <class T, int ChunkSize = 1024 * 1024>
 class ChunkPool
 {
@@ -46,8 +48,14 @@ public:
 		}
 	}
 
+	//free chunks are not kept if the memory budget is tight
 	void returnChunk(T* chunk)
 	{
+		if (MemoryBudget::get().underPressure())
+		{
+			delete[] chunk;
+			return;
+		}
 		std::lock_guard<std::mutex> lock(_chunkMutex);
 		_freeChunks.push_back(chunk);
 	}
@@ -0,0 +1,107 @@
+//(c) 2016-2020 by Authors
+//This file is a part of Flye program.
+//Released under the BSD license (see LICENSE file)
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+//Blocked Bloom filter: all bits of a key are set within a single
+//512-bit block (one cache line), one bit per 64-bit word, so a query
+//costs a single memory access. Keys are given as well-mixed 64-bit
+//hashes: the upper half selects the block, the lower half - the bits.
+//An empty (not initialized) filter reports every key as present
+class BlockedBloomFilter
+{
+public:
+	BlockedBloomFilter(): _words(nullptr), _numBlocks(0) {}
+
+	BlockedBloomFilter(const BlockedBloomFilter&) = delete;
+	void operator=(const BlockedBloomFilter&) = delete;
+
+	static size_t memoryRequired(size_t numKeys, size_t bitsPerKey)
+	{
+		return numBlocksFor(numKeys, bitsPerKey) * BLOCK_WORDS *
+			   sizeof(uint64_t);
+	}
+
+	void init(size_t numKeys, size_t bitsPerKey)
+	{
+		_numBlocks = numBlocksFor(numKeys, bitsPerKey);
+		_storage.assign(_numBlocks * BLOCK_WORDS + BLOCK_WORDS - 1, 0);
+
+		//std::vector only guarantees the alignment of the element type
+		uintptr_t addr = (uintptr_t)_storage.data();
+		uintptr_t aligned = (addr + BLOCK_BYTES - 1) / BLOCK_BYTES * BLOCK_BYTES;
+		_words = _storage.data() + (aligned - addr) / sizeof(uint64_t);
+	}
+
+	void clear()
+	{
+		std::vector<uint64_t>().swap(_storage);
+		_words = nullptr;
+		_numBlocks = 0;
+	}
+
+	bool empty() const {return _numBlocks == 0;}
+
+	//not thread-safe, the filter should be filled before the queries
+	void insert(uint64_t hash)
+	{
+		uint64_t* block = this->getBlock(hash);
+		for (size_t i = 0; i < BLOCK_WORDS; ++i)
+		{
+			block[i] |= bitMask(hash, i);
+		}
+	}
+
+	bool mayContain(uint64_t hash) const
+	{
+		if (!_numBlocks) return true;
+
+		const uint64_t* block = this->getBlock(hash);
+		for (size_t i = 0; i < BLOCK_WORDS; ++i)
+		{
+			if (!(block[i] & bitMask(hash, i))) return false;
+		}
+		return true;
+	}
+
+	void prefetch(uint64_t hash) const
+	{
+		if (_numBlocks) __builtin_prefetch(this->getBlock(hash));
+	}
+
+private:
+	static const size_t BLOCK_WORDS = 8;
+	static const size_t BLOCK_BYTES = BLOCK_WORDS * sizeof(uint64_t);
+
+	static size_t numBlocksFor(size_t numKeys, size_t bitsPerKey)
+	{
+		size_t blockBits = BLOCK_BYTES * 8;
+		return (numKeys * bitsPerKey + blockBits - 1) / blockBits + 1;
+	}
+
+	//multiply-shift instead of modulo
+	uint64_t* getBlock(uint64_t hash) const
+	{
+		size_t blockId = ((hash >> 32) * _numBlocks) >> 32;
+		return _words + blockId * BLOCK_WORDS;
+	}
+
+	//each word gets an independent 6-bit position, derived from
+	//the lower half of the hash with a different odd multiplier
+	static uint64_t bitMask(uint64_t hash, size_t word)
+	{
+		static const uint32_t SALT[BLOCK_WORDS] =
+			{0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+			 0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+		uint32_t bit = ((uint32_t)hash * SALT[word]) >> 26;
+		return 1ULL << bit;
+	}
+
+	std::vector<uint64_t> _storage;
+	uint64_t* _words;
+	size_t 	  _numBlocks;
+};
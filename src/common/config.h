@@ -112,4 +112,6 @@ struct Parameters
 	size_t 	kmerSize;
 	size_t 	numThreads;
 	bool 	unevenCoverage;
+	//results do not depend on the number of threads
+	bool 	deterministic;
 };
@@ -6,9 +6,24 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <ctime>
 #include <stdexcept>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
+//Log messages are assembled into complete records by StreamWriter
+//(owned by the calling thread), and then passed through a lock-free
+//queue to the background writer thread. Debug records are written
+//asynchronously, while info / warning / error calls wait until
+//their own record (and thus all records queued before it) is written,
+//so the console output stays in order with the progress bars
+//(which are printed directly)
 class Logger
 {
 public:
@@ -20,9 +35,10 @@ public:
 
 	void setOutputFile(const std::string& filename)
 	{
+		this->flush();
 		_logFile.open(filename, std::ofstream::out | std::ofstream::app);
 		_logFileSet = true;
-		if (!_logFile.is_open()) 
+		if (!_logFile.is_open())
 		{
 			throw std::runtime_error("Can't open log file");
 		}
@@ -33,73 +49,229 @@ public:
 	class StreamWriter
 	{
 	public:
-		StreamWriter(const std::string& level, 
-					 std::ostream* consoleStream = nullptr,
-					 std::ostream* fileStream = nullptr):
-			_fileStream(fileStream), _consoleStream(consoleStream)
+		StreamWriter(const char* level, bool toConsole, bool toFile,
+					 bool synchronous):
+			_level(level), _toConsole(toConsole), _toFile(toFile),
+			_synchronous(synchronous), _active(toConsole || toFile)
+		{}
+		StreamWriter(StreamWriter&& other):
+			_level(other._level), _toConsole(other._toConsole),
+			_toFile(other._toFile), _synchronous(other._synchronous),
+			_active(other._active), _buffer(std::move(other._buffer))
 		{
-			if (_fileStream) *_fileStream << timestamp() << " " << level << " ";
-			if (_consoleStream) *_consoleStream << timestamp() 
-												<< " " << level << " ";
+			other._active = false;
 		}
+		StreamWriter(const StreamWriter&) = delete;
+		StreamWriter& operator=(const StreamWriter&) = delete;
+
 		~StreamWriter()
 		{
-			if (_fileStream) *_fileStream << std::endl;
-			if (_consoleStream) *_consoleStream << std::endl;
+			if (!_active) return;
+			Logger::get().enqueue(new Record(_level, _buffer.str(),
+											 _toConsole, _toFile),
+								  _synchronous);
 		}
-		
+
+		//disabled writers skip the formatting entirely
 		template <class T>
 		Logger::StreamWriter& operator<< (const T& val)
 		{
-			if (_fileStream) *_fileStream << val;
-			if (_consoleStream) *_consoleStream << val;
+			if (_active) _buffer << val;
 			return *this;
 		}
 
 	private:
-		std::ostream* _fileStream;
-		std::ostream* _consoleStream;
+		const char* _level;
+		bool _toConsole;
+		bool _toFile;
+		bool _synchronous;
+		bool _active;
+		std::ostringstream _buffer;
 	};
 
 	StreamWriter info()
 	{
-		std::ostream* logPtr = _logFileSet ? &_logFile : nullptr;
-		return StreamWriter("INFO:", &std::cerr, logPtr);
+		return StreamWriter("INFO:", true, _logFileSet, /*sync*/ true);
 	}
 
 	StreamWriter warning()
 	{
-		std::ostream* logPtr = _logFileSet ? &_logFile : nullptr;
-		return StreamWriter("WARNING:", &std::cerr, logPtr);
+		return StreamWriter("WARNING:", true, _logFileSet, /*sync*/ true);
 	}
 
 	StreamWriter error()
 	{
-		std::ostream* logPtr = _logFileSet ? &_logFile : nullptr;
-		return StreamWriter("ERROR:", &std::cerr, logPtr);
+		return StreamWriter("ERROR:", true, _logFileSet, /*sync*/ true);
 	}
 
 	StreamWriter debug()
 	{
-		std::ostream* logPtr = _logFileSet ? &_logFile : nullptr;
-		std::ostream* consolePtr = _debug ? &std::cerr : nullptr;
-		return StreamWriter("DEBUG:", consolePtr, logPtr);
+		return StreamWriter("DEBUG:", _debug, _logFileSet, /*sync*/ false);
 	}
 
-private:
-	static std::string timestamp(const char* format = "[%Y-%m-%d %H:%M:%S]")
+	//for the crash handlers: writes an error directly to the console and 
+	//the log file, bypassing the queue. Waiting for the writer thread is
+	//not safe there, since the crash might happen in the writer itself
+	//(records still in the queue are lost)
+	void crashError(const std::string& text)
 	{
-		std::time_t t = std::time(0);
+		std::time_t time = std::time(0);
 		char cstr[256];
-		std::strftime(cstr, sizeof(cstr), format, std::localtime(&t));
-		return cstr;
+		std::strftime(cstr, sizeof(cstr), "[%Y-%m-%d %H:%M:%S]",
+					  std::localtime(&time));
+		std::string line = std::string(cstr) + " ERROR: " + text + "\n";
+		std::cerr << line;
+		if (_logFileSet) 
+		{
+			_logFile << line;
+			_logFile.flush();
+		}
+	}
+
+	//blocks until all the records logged so far are written
+	//(by queuing an empty record and waiting for it)
+	void flush()
+	{
+		this->enqueue(new Record("", std::string(), false, false),
+					  /*sync*/ true);
+	}
+
+private:
+	struct Record
+	{
+		Record(const char* level, std::string&& text,
+			   bool toConsole, bool toFile):
+			next(nullptr), level(level), time(std::time(0)),
+			text(std::move(text)), toConsole(toConsole), toFile(toFile),
+			written(nullptr)
+		{}
+
+		std::atomic<Record*> next;
+		const char* level;
+		std::time_t time;
+		std::string text;
+		bool toConsole;
+		bool toFile;
+		//set (under _flushMutex) once the record is written, if
+		//a synchronous producer waits for it. Owned by the producer,
+		//since the record itself is deleted by the writer thread
+		bool* written;
+	};
+
+	//multiple-producer single-consumer intrusive queue (D. Vyukov).
+	//Producers only exchange the head pointer, the writer
+	//thread consumes from the tail, which is always a stub record.
+	//Records are written in the exchange order, so once a record 
+	//is written, so are all the records queued before it
+	void enqueue(Record* record, bool synchronous)
+	{
+		bool written = false;
+		if (synchronous) record->written = &written;
+
+		Record* prev = _queueHead.exchange(record, std::memory_order_acq_rel);
+		prev->next.store(record, std::memory_order_release);
+		if (!synchronous) return;
+
+		{
+			std::lock_guard<std::mutex> lock(_wakeMutex);
+			_wakeRequested = true;
+		}
+		_wakeCv.notify_one();
+
+		std::unique_lock<std::mutex> lock(_flushMutex);
+		_flushCv.wait(lock, [&written]{return written;});
+	}
+
+	Record* dequeue()
+	{
+		Record* next = _queueTail->next.load(std::memory_order_acquire);
+		if (!next) return nullptr;
+		delete _queueTail;
+		_queueTail = next;
+		return next;
+	}
+
+	//writes all available records, returns the number of written ones
+	size_t writeAvailable()
+	{
+		size_t numWritten = 0;
+		//a record is deleted on the next dequeue, so only
+		//the producers' flags are kept until the file is flushed
+		_writtenFlags.clear();
+		while (Record* record = this->dequeue())
+		{
+			if (record->toFile || record->toConsole)
+			{
+				const std::string& prefix = this->timestamp(record->time);
+				std::string line = prefix + " " + record->level + " " +
+								   record->text + "\n";
+				if (record->toFile) _logFile << line;
+				if (record->toConsole) std::cerr << line;
+			}
+			if (record->written) _writtenFlags.push_back(record->written);
+			++numWritten;
+		}
+		if (numWritten && _logFileSet) _logFile.flush();
+		if (!_writtenFlags.empty())
+		{
+			{
+				std::lock_guard<std::mutex> lock(_flushMutex);
+				for (bool* flag : _writtenFlags) *flag = true;
+			}
+			_flushCv.notify_all();
+		}
+		return numWritten;
+	}
+
+	void writerLoop()
+	{
+		const auto POLL_INTERVAL = std::chrono::milliseconds(50);
+		while (true)
+		{
+			if (this->writeAvailable()) continue;
+
+			std::unique_lock<std::mutex> lock(_wakeMutex);
+			if (_stopWriter && !_queueTail->next.load()) break;
+			_wakeCv.wait_for(lock, POLL_INTERVAL,
+							 [this]{return _wakeRequested || _stopWriter;});
+			_wakeRequested = false;
+		}
+	}
+
+	//formatting is only done once per second
+	const std::string& timestamp(std::time_t time)
+	{
+		if (time != _lastTime || _lastTimestamp.empty())
+		{
+			char cstr[256];
+			std::strftime(cstr, sizeof(cstr), "[%Y-%m-%d %H:%M:%S]",
+						  std::localtime(&time));
+			_lastTimestamp = cstr;
+			_lastTime = time;
+		}
+		return _lastTimestamp;
 	}
 
 	Logger():
-		_debug(false), _logFileSet(false)
-	{}
+		_debug(false), _logFileSet(false), _queueHead(nullptr),
+		_queueTail(nullptr),
+		_wakeRequested(false), _stopWriter(false), _lastTime(0)
+	{
+		Record* stub = new Record("", std::string(), false, false);
+		_queueHead = stub;
+		_queueTail = stub;
+		_writerThread = std::thread(&Logger::writerLoop, this);
+	}
 	~Logger()
 	{
+		{
+			std::lock_guard<std::mutex> lock(_wakeMutex);
+			_stopWriter = true;
+		}
+		_wakeCv.notify_one();
+		_writerThread.join();
+		delete _queueTail;
+
 		if (_logFileSet)
 		{
 			_logFile << "-----------End assembly log------------\n";
@@ -109,4 +281,20 @@ private:
 	bool _debug;
 	bool _logFileSet;
 	std::ofstream _logFile;
+
+	std::atomic<Record*> _queueHead;
+	Record* _queueTail;
+	std::vector<bool*> _writtenFlags;
+
+	std::mutex _wakeMutex;
+	std::condition_variable _wakeCv;
+	bool _wakeRequested;
+	bool _stopWriter;
+
+	std::mutex _flushMutex;
+	std::condition_variable _flushCv;
+
+	std::thread _writerThread;
+	std::time_t _lastTime;
+	std::string _lastTimestamp;
 };
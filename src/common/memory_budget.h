@@ -0,0 +1,119 @@
+//(c) 2016-2020 by Authors
+//This file is a part of Flye program.
+//Released under the BSD license (see LICENSE file)
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <algorithm>
+
+#include "memory_info.h"
+#include "logger.h"
+
+//Memory budget of the process. By default, it is set to the RAM
+//available at the start (or the cgroup limit, if it is lower),
+//and could be set explicitly with the --memory-limit option.
+//The large allocators consult the budget to switch to lower-memory
+//strategies in advance, instead of being killed in the middle of a run
+class MemoryBudget
+{
+public:
+	static MemoryBudget& get()
+	{
+		static MemoryBudget instance;
+		return instance;
+	}
+
+	//zero resets the limit to the default one
+	void setLimit(size_t bytes)
+	{
+		_limit = bytes ? bytes : defaultLimit();
+	}
+
+	size_t getLimit() const {return _limit;}
+
+	//resident memory of the process. Reading it is relatively
+	//expensive, so the value is refreshed at most every REFRESH_MS
+	size_t getUsage()
+	{
+		const int64_t REFRESH_MS = 100;
+		int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>
+			(std::chrono::steady_clock::now().time_since_epoch()).count();
+		if (now - _lastUpdate.load() >= REFRESH_MS)
+		{
+			_usage = getCurrentRSS();
+			_lastUpdate = now;
+		}
+		return _usage;
+	}
+
+	size_t getAvailable()
+	{
+		size_t usage = this->getUsage();
+		return usage < _limit ? _limit - usage : 0;
+	}
+
+	//checks if an allocation of the given size fits into the budget,
+	//leaving a safety margin for the smaller allocations
+	bool fits(size_t bytes)
+	{
+		return this->getUsage() + bytes <= _limit * SAFE_RATE;
+	}
+
+	//usage is approaching the limit, so the caches should not grow
+	bool underPressure()
+	{
+		return this->getUsage() > _limit * PRESSURE_RATE;
+	}
+
+	void logStatus()
+	{
+		const double GB = 1024 * 1024 * 1024;
+		Logger::get().debug() << "Memory budget: " << _limit / GB
+			<< " Gb, used: " << this->getUsage() / GB << " Gb";
+	}
+
+private:
+	MemoryBudget():
+		_limit(defaultLimit()), _usage(0), _lastUpdate(INT64_MIN / 2)
+	{}
+
+	static size_t defaultLimit()
+	{
+		size_t available = getFreeMemorySize();
+		size_t limit = available ? getCurrentRSS() + available : getMemorySize();
+		size_t cgroupLimit = getCgroupLimit();
+		if (cgroupLimit) limit = std::min(limit, cgroupLimit);
+		return limit;
+	}
+
+	//memory limit of the cgroup (v2 or v1), zero if not set
+	static size_t getCgroupLimit()
+	{
+		const std::string LIMIT_FILES[] =
+			{"/sys/fs/cgroup/memory.max",
+			 "/sys/fs/cgroup/memory/memory.limit_in_bytes"};
+		for (const auto& filename : LIMIT_FILES)
+		{
+			std::ifstream fin(filename);
+			std::string value;
+			if (!(fin >> value) || value == "max") continue;
+			size_t limit = std::strtoull(value.c_str(), nullptr, 10);
+			//v1 reports a huge number if there is no limit
+			if (limit > 0 && limit < getMemorySize()) return limit;
+		}
+		return 0;
+	}
+
+	const float SAFE_RATE = 0.9f;
+	const float PRESSURE_RATE = 0.8f;
+
+	size_t _limit;
+	std::atomic<size_t> _usage;
+	std::atomic<int64_t> _lastUpdate;
+};
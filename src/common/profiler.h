@@ -0,0 +1,223 @@
+//(c) 2016-2020 by Authors
+//This file is a part of Flye program.
+//Released under the BSD license (see LICENSE file)
+
+#pragma once
+
+#include <chrono>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+#include "memory_info.h"
+#include "logger.h"
+
+//Lightweight instrumentation of the pipeline stages. Phases are
+//timed with ScopedPhase guards (which could be nested), counters are
+//accumulated per thread without locking and merged into the innermost
+//active phase when it ends. Once the outermost phase is finished,
+//the report is appended to the profile file as a single JSON line
+class Profiler
+{
+public:
+	static Profiler& get()
+	{
+		static Profiler instance;
+		return instance;
+	}
+
+	//all modules of a single run share the same profile file,
+	//which is placed next to the given file (e.g. the log)
+	void setOutputFileNear(const std::string& neighbourFile)
+	{
+		size_t slash = neighbourFile.rfind('/');
+		std::string dir = (slash == std::string::npos) ?
+						  "" : neighbourFile.substr(0, slash + 1);
+		_outFile = dir + "flye_profile.jsonl";
+	}
+
+	//adds value to the counter of the current thread.
+	//The name is expected to be a string literal
+	static void count(const char* name, int64_t value = 1)
+	{
+		threadCounters().values[name] += value;
+	}
+
+	class ScopedPhase
+	{
+	public:
+		explicit ScopedPhase(const std::string& name)
+		{
+			Profiler::get().beginPhase(name);
+		}
+		~ScopedPhase()
+		{
+			Profiler::get().endPhase();
+		}
+		//finishes the current phase and starts the next one at the same level
+		void switchTo(const std::string& name)
+		{
+			Profiler::get().endPhase();
+			Profiler::get().beginPhase(name);
+		}
+		ScopedPhase(const ScopedPhase&) = delete;
+		ScopedPhase& operator=(const ScopedPhase&) = delete;
+	};
+
+private:
+	Profiler() {}
+
+	struct PhaseRecord
+	{
+		std::string name;
+		int depth;
+		std::chrono::steady_clock::time_point wallStart;
+		std::clock_t cpuStart;
+		size_t rssStart;
+		double wallSeconds;
+		double cpuSeconds;
+		size_t rssEnd;
+		size_t peakRss;
+		std::map<std::string, int64_t> counters;
+	};
+
+	//counters of the worker threads are merged on the thread exit,
+	//and are later attributed to the phase that is active at that time
+	struct ThreadCounters
+	{
+		std::unordered_map<const char*, int64_t> values;
+		~ThreadCounters()
+		{
+			Profiler::get().mergeCounters(values);
+		}
+	};
+
+	static ThreadCounters& threadCounters()
+	{
+		thread_local ThreadCounters counters;
+		return counters;
+	}
+
+	void mergeCounters(std::unordered_map<const char*, int64_t>& values)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (auto& nameVal : values) _pendingCounters[nameVal.first] += nameVal.second;
+		values.clear();
+	}
+
+	void beginPhase(const std::string& name)
+	{
+		//counts made before the phase belong to the outer phase
+		this->mergeCounters(threadCounters().values);
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		this->flushPending();
+		PhaseRecord phase;
+		phase.name = _activePhases.empty() ? name :
+					 _phases[_activePhases.back()].name + "/" + name;
+		phase.depth = _activePhases.size();
+		phase.wallStart = std::chrono::steady_clock::now();
+		phase.cpuStart = std::clock();
+		phase.rssStart = getCurrentRSS();
+		phase.wallSeconds = phase.cpuSeconds = 0;
+		phase.rssEnd = phase.peakRss = 0;
+		_activePhases.push_back(_phases.size());
+		_phases.push_back(phase);
+	}
+
+	void endPhase()
+	{
+		this->mergeCounters(threadCounters().values);
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		this->flushPending();
+		PhaseRecord& phase = _phases[_activePhases.back()];
+		phase.wallSeconds = std::chrono::duration<double>
+			(std::chrono::steady_clock::now() - phase.wallStart).count();
+		phase.cpuSeconds = double(std::clock() - phase.cpuStart) / CLOCKS_PER_SEC;
+		phase.rssEnd = getCurrentRSS();
+		phase.peakRss = getPeakRSS();
+		_activePhases.pop_back();
+
+		if (_activePhases.empty())
+		{
+			this->writeReport();
+			_phases.clear();
+		}
+	}
+
+	//attributes the pending counters to the innermost active phase
+	void flushPending()
+	{
+		if (!_activePhases.empty())
+		{
+			auto& counters = _phases[_activePhases.back()].counters;
+			for (auto& nameVal : _pendingCounters) counters[nameVal.first] += nameVal.second;
+		}
+		_pendingCounters.clear();
+	}
+
+	static std::string jsonString(const std::string& str)
+	{
+		std::string escaped = "\"";
+		for (char c : str)
+		{
+			if (c == '"' || c == '\\') escaped += '\\';
+			escaped += c;
+		}
+		return escaped + "\"";
+	}
+
+	void writeReport()
+	{
+		if (_outFile.empty()) return;
+
+		const double MB = 1024 * 1024;
+		std::ostringstream ss;
+		ss << std::fixed << std::setprecision(3);
+		ss << "{\"module\": " << jsonString(_phases.front().name)
+		   << ", \"phases\": [";
+		for (size_t i = 0; i < _phases.size(); ++i)
+		{
+			const PhaseRecord& phase = _phases[i];
+			if (i > 0) ss << ", ";
+			ss << "{\"name\": " << jsonString(phase.name)
+			   << ", \"depth\": " << phase.depth
+			   << ", \"wall_sec\": " << phase.wallSeconds
+			   << ", \"cpu_sec\": " << phase.cpuSeconds
+			   << ", \"rss_start_mb\": " << phase.rssStart / MB
+			   << ", \"rss_end_mb\": " << phase.rssEnd / MB
+			   << ", \"peak_rss_mb\": " << phase.peakRss / MB
+			   << ", \"counters\": {";
+			bool first = true;
+			for (auto& nameVal : phase.counters)
+			{
+				if (!first) ss << ", ";
+				first = false;
+				ss << jsonString(nameVal.first) << ": " << nameVal.second;
+			}
+			ss << "}}";
+		}
+		ss << "]}\n";
+
+		std::ofstream fout(_outFile, std::ofstream::out | std::ofstream::app);
+		if (!fout.is_open())
+		{
+			Logger::get().warning() << "Can't write profile to " << _outFile;
+			return;
+		}
+		fout << ss.str();
+	}
+
+	std::mutex _mutex;
+	std::string _outFile;
+	std::vector<PhaseRecord> _phases;
+	std::vector<size_t> _activePhases;
+	std::unordered_map<const char*, int64_t> _pendingCounters;
+};
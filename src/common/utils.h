@@ -70,11 +70,11 @@ inline void segfaultHandler(int signal __attribute__((unused)))
 {
 	void *stackArray[20];
 	size_t size = backtrace(stackArray, 10);
-	Logger::get().error() << "Segmentation fault! Backtrace:";
+	Logger::get().crashError("Segmentation fault! Backtrace:");
 	char** backtrace = backtrace_symbols(stackArray, size);
 	for (size_t i = 0; i < size; ++i)
 	{
-		Logger::get().error() << "\t" << backtrace[i];
+		Logger::get().crashError(std::string("\t") + backtrace[i]);
 	}
 	abort();
 }
@@ -92,7 +92,8 @@ inline void exceptionHandler()
     }
     catch (const std::exception &e) 
 	{
-        Logger::get().error() << "Caught unhandled exception: " << e.what();
+        Logger::get().crashError(std::string("Caught unhandled exception: ") + 
+								 e.what());
     }
 	catch (...) {}
 
@@ -101,7 +102,7 @@ inline void exceptionHandler()
 	char** backtrace = backtrace_symbols(stackArray, size);
 	for (size_t i = 0; i < size; ++i)
 	{
-		Logger::get().error() << "\t" << backtrace[i];
+		Logger::get().crashError(std::string("\t") + backtrace[i]);
 	}
 	abort();
 }
@@ -4,7 +4,9 @@
 
 #include "contig_extender.h"
 #include "../repeat_graph/output_generator.h"
+#include "../common/parallel.h"
 #include <cmath>
+#include <numeric>
 
 void ContigExtender::generateUnbranchingPaths()
 {
@@ -58,32 +60,29 @@ void ContigExtender::generateUnbranchingPaths()
 }
 
 
+//Contigs are extended into the adjacent repeats using the longest
+//read alignments. Extensions are selected for all contigs in parallel,
+//however each choice depends on the repeat directions marked by the 
+//previous contigs. So the extensions are then committed in the
+//original order, and those that checked an edge whose direction
+//has changed since are recomputed. The result is the same as with
+//the sequential processing.
 void ContigExtender::generateContigs()
 {
 	Logger::get().debug() << "Extending contigs into repeats";
 
 	bool graphContinue = (bool)Config::get("extend_contigs_with_repeats");
+	const int32_t MAX_SEPARATION = Config::get("max_separation");
 
 	OutputGenerator outGen(_graph, _aligner);
 	auto coreSeqs = outGen.generatePathSequences(_unbranchingPaths);
-	std::unordered_map<UnbranchingPath*, FastaRecord*> upathsSeqs;
+	std::unordered_map<const UnbranchingPath*, const FastaRecord*> upathsSeqs;
 	for (size_t i = 0; i < _unbranchingPaths.size(); ++i)
 	{
 		upathsSeqs[&_unbranchingPaths[i]] = &coreSeqs[i];
 	}
 
-	std::unordered_map<GraphEdge*, 
-					   std::vector<const GraphAlignment*>> alnIndex;
-	for (auto& aln : _aligner.getAlignments())
-	{
-		if (aln.size() > 1)
-		{
-			for (auto edge : aln)
-			{
-				alnIndex[edge.edge].push_back(&aln);
-			}
-		}
-	}
+	const AlignmentIndex& alnIndex = _aligner.getAlignmentIndex();
 
 	std::unordered_set<GraphEdge*> coveredRepeats;
 	std::unordered_map<const GraphEdge*, bool> repeatDirections;
@@ -94,22 +93,19 @@ void ContigExtender::generateContigs()
 			   repeatDirections.at(edge);
 	};
 
-	typedef std::pair<GraphPath, std::string> PathAndSeq;
-	auto extendPathRight =
-		[this, &coveredRepeats, &repeatDirections, &upathsSeqs, 
-		 &canTraverse, &alnIndex, graphContinue] 
-	(UnbranchingPath& upath)
+	//first, choose the longest aligned read from this edge.
+	//The edges that were checked for traversal are recorded
+	auto findExtension = [&alnIndex, &canTraverse] 
+		(const UnbranchingPath& upath, 
+		 std::vector<const GraphEdge*>& checkedEdges)
 	{
-
+		GraphAlignment bestAlignment;
 		bool extendFwd = !upath.path.back()->nodeRight->outEdges.empty();
-		if (!extendFwd) return PathAndSeq();
+		if (!extendFwd) return bestAlignment;
 
-		//first, choose the longest aligned read from this edge
 		int32_t maxExtension = 0;
-		GraphAlignment bestAlignment;
-		for (auto pathPtr : alnIndex[upath.path.back()])
+		for (const GraphAlignment& path : alnIndex[upath.path.back()])
 		{
-			const GraphAlignment& path = *pathPtr;
 			for (size_t i = 0; i < path.size(); ++i)
 			{
 				if (path[i].edge == upath.path.back() &&
@@ -118,8 +114,12 @@ void ContigExtender::generateContigs()
 					size_t j = i + 1;
 					while (j < path.size() && 
 						   path[j].edge->repetitive &&
-						   !path[j].edge->altHaplotype &&
-						   canTraverse(path[j].edge)) ++j;
+						   !path[j].edge->altHaplotype)
+					{
+						checkedEdges.push_back(path[j].edge);
+						if (!canTraverse(path[j].edge)) break;
+						++j;
+					}
 					if (j == i + 1) break;
 
 					int32_t alnLen = path[j - 1].overlap.curEnd - 
@@ -135,16 +135,40 @@ void ContigExtender::generateContigs()
 				}
 			}
 		}
-		if (maxExtension == 0) return PathAndSeq();
+		return bestAlignment;
+	};
 
-		auto upathAln = this->asUpathAlignment(bestAlignment);
+	//splits the extension into unbranching paths, returns true
+	//if the last one is only partially covered by the read
+	auto asUpathExtension = [this, &upathsSeqs, MAX_SEPARATION]
+		(const GraphAlignment& bestAlignment, 
+		 std::vector<UpathAlignment>& upathAln)
+	{
+		upathAln = this->asUpathAlignment(bestAlignment);
 		auto lastUpath = upathAln.back().upath;
-		int32_t overhang = upathsSeqs[lastUpath]->sequence.length() - 
+		int32_t overhang = upathsSeqs.at(lastUpath)->sequence.length() - 
 						   upathAln.back().aln.back().overlap.curEnd + 
 						   upathAln.back().aln.front().overlap.curBegin;
-		bool lastIncomplete = overhang > (int)Config::get("max_separation");
-		//Logger::get().debug() << "Ctg " << upath.id.signedId() <<
-		//	" overhang " << overhang << " upath " << lastUpath->id.signedId();
+		return overhang > MAX_SEPARATION;
+	};
+
+	//marks the repeats covered by the extension, and records
+	//the edges that have changed their traversal status
+	std::unordered_set<const GraphEdge*> changedEdges;
+	auto markCovered = [this, &coveredRepeats, &repeatDirections, 
+						&changedEdges, &canTraverse, &asUpathExtension, 
+						graphContinue] 
+		(const GraphAlignment& bestAlignment)
+	{
+		if (bestAlignment.empty()) return;
+
+		std::vector<UpathAlignment> upathAln;
+		bool lastIncomplete = asUpathExtension(bestAlignment, upathAln);
+		auto setDirection = [&](GraphEdge* edge, bool direction)
+		{
+			if (canTraverse(edge) != direction) changedEdges.insert(edge);
+			repeatDirections[edge] = direction;
+		};
 
 		for (size_t i = 0; i < upathAln.size(); ++i)
 		{
@@ -156,15 +180,26 @@ void ContigExtender::generateContigs()
 
 			for (auto& aln : upathAln[i].aln)
 			{
-				repeatDirections[aln.edge] = true;
-				repeatDirections[_graph.complementEdge(aln.edge)] = false;
+				setDirection(aln.edge, true);
+				setDirection(_graph.complementEdge(aln.edge), false);
 				coveredRepeats.insert(aln.edge);
 				coveredRepeats.insert(_graph.complementEdge(aln.edge));
 			}
 		}
+	};
+
+	//generates the extension path and sequence
+	typedef std::pair<GraphPath, DnaSequence> PathAndSeq;
+	auto extensionSequence = [this, &upathsSeqs, &asUpathExtension, 
+							  graphContinue]
+		(const GraphAlignment& bestAlignment)
+	{
+		PathAndSeq extension;
+		if (bestAlignment.empty()) return extension;
 
-		//generate extension sequence
-		std::string extendedSeq;
+		std::vector<UpathAlignment> upathAln;
+		bool lastIncomplete = asUpathExtension(bestAlignment, upathAln);
+		auto lastUpath = upathAln.back().upath;
 		if (lastIncomplete && graphContinue)
 		{
 			upathAln.pop_back();
@@ -174,24 +209,23 @@ void ContigExtender::generateContigs()
 			FastaRecord::Id readId = bestAlignment.front().overlap.curId;
 			int32_t readStart = upathAln.front().aln.front().overlap.curBegin;
 			int32_t readEnd = upathAln.back().aln.back().overlap.curEnd;
-			extendedSeq = _readSeqs.getSeq(readId)
-				.substr(readStart, readEnd - readStart).str();
+			extension.second.append(_readSeqs.getSeq(readId)
+										.substr(readStart, readEnd - readStart));
 		}
 		if (lastIncomplete && graphContinue)
 		{
-			extendedSeq += upathsSeqs[lastUpath]->sequence.str();
+			extension.second.append(upathsSeqs.at(lastUpath)->sequence);
 		}
 		
-		GraphPath extendedPath;
 		for (auto& ualn : upathAln)
 		{
-			for (auto& edgeAln : ualn.aln) extendedPath.push_back(edgeAln.edge);
+			for (auto& edgeAln : ualn.aln) extension.first.push_back(edgeAln.edge);
 		}
 		if (lastIncomplete && graphContinue)
 		{
-			for (auto& edge : lastUpath->path) extendedPath.push_back(edge);
+			for (auto& edge : lastUpath->path) extension.first.push_back(edge);
 		}
-		return PathAndSeq(extendedPath, extendedSeq);
+		return extension;
 	};
 
 	std::unordered_map<FastaRecord::Id, UnbranchingPath*> idToPath;
@@ -200,17 +234,73 @@ void ContigExtender::generateContigs()
 		idToPath[ctg.id] = &ctg;
 	}
 
+	//extending contigs to the right, then the complements
+	//(which are the left extensions)
+	struct ContigExtension
+	{
+		UnbranchingPath* upath;
+		UnbranchingPath* complUpath;
+		GraphAlignment alignment[2];
+		std::vector<const GraphEdge*> checkedEdges[2];
+	};
+	std::vector<ContigExtension> extensions;
 	for (auto& upath : _unbranchingPaths)
 	{
 		if (upath.repetitive || !upath.id.strand()) continue;
 		if (!idToPath.count(upath.id.rc())) continue;	//self-complement
 
-		auto rightExt = extendPathRight(upath);
-		auto leftExt = extendPathRight(*idToPath[upath.id.rc()]);
+		extensions.emplace_back();
+		extensions.back().upath = &upath;
+		extensions.back().complUpath = idToPath[upath.id.rc()];
+	}
+
+	std::vector<size_t> extensionIds(extensions.size());
+	std::iota(extensionIds.begin(), extensionIds.end(), 0);
+	std::function<void(const size_t&)> findFun = 
+	[&extensions, &findExtension] (const size_t& extId)
+	{
+		auto& ext = extensions[extId];
+		ext.alignment[0] = findExtension(*ext.upath, ext.checkedEdges[0]);
+		ext.alignment[1] = findExtension(*ext.complUpath, ext.checkedEdges[1]);
+	};
+	processInParallel(extensionIds, findFun, 
+					  Parameters::get().numThreads, false);
+
+	int numRecomputed = 0;
+	for (auto& ext : extensions)
+	{
+		for (int side = 0; side < 2; ++side)
+		{
+			bool outdated = false;
+			for (auto edge : ext.checkedEdges[side])
+			{
+				if (changedEdges.count(edge)) outdated = true;
+			}
+			if (outdated)
+			{
+				const UnbranchingPath& upath = side == 0 ? *ext.upath : 
+														   *ext.complUpath;
+				ext.checkedEdges[side].clear();
+				ext.alignment[side] = findExtension(upath, ext.checkedEdges[side]);
+				++numRecomputed;
+			}
+			markCovered(ext.alignment[side]);
+		}
+	}
+	Logger::get().debug() << "Recomputed " << numRecomputed 
+		<< " contig extensions out of " << extensions.size() * 2;
+
+	for (auto& ext : extensions) _contigs.emplace_back(*ext.upath);
+	std::function<void(const size_t&)> contigFun = 
+	[this, &extensions, &extensionSequence, &upathsSeqs] 
+	(const size_t& extId)
+	{
+		auto& ext = extensions[extId];
+		auto rightExt = extensionSequence(ext.alignment[0]);
+		auto leftExt = extensionSequence(ext.alignment[1]);
 		leftExt.first = _graph.complementPath(leftExt.first);
-		leftExt.second = DnaSequence(leftExt.second).complement().str();
 
-		Contig contig(upath);
+		Contig& contig = _contigs[extId];
 		auto leftPaths = this->asUpaths(leftExt.first);
 		auto rightPaths = this->asUpaths(rightExt.first);
 
@@ -236,11 +326,14 @@ void ContigExtender::generateContigs()
 		contig.graphPaths.insert(contig.graphPaths.end(), 
 								 rightPaths.begin(), rightPaths.end());
 
-		auto coreSeq = upathsSeqs[&upath]->sequence.str();
-		contig.sequence = DnaSequence(leftExt.second + coreSeq + rightExt.second);
-
-		_contigs.push_back(std::move(contig));
-	}
+		DnaSequence sequence;
+		sequence.append(leftExt.second.complement());
+		sequence.append(upathsSeqs.at(ext.upath)->sequence);
+		sequence.append(rightExt.second);
+		contig.sequence = sequence;
+	};
+	processInParallel(extensionIds, contigFun, 
+					  Parameters::get().numThreads, false);
 
 	//add repetitive contigs that were not covered by the extended paths
 	int numCovered = 0;
@@ -256,7 +349,7 @@ void ContigExtender::generateContigs()
 		if (!covered)
 		{
 			_contigs.emplace_back(upath);
-			_contigs.back().sequence = upathsSeqs[&upath]->sequence;
+			_contigs.back().sequence = upathsSeqs.at(&upath)->sequence;
 		}
 		else
 		{
@@ -14,6 +14,9 @@
 #include "../common/logger.h"
 #include "../common/utils.h"
 #include "../common/memory_info.h"
+#include "../common/memory_budget.h"
+#include "../common/arena_allocator.h"
+#include "../common/profiler.h"
 
 #include "../repeat_graph/repeat_graph.h"
 #include "../repeat_graph/read_aligner.h"
@@ -28,7 +31,7 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 			   int& minOverlap, bool& debug, size_t& numThreads, 
 			   std::string& configPath, std::string& inRepeatGraph,
 			   std::string& inReadsAlignment, bool& noScaffold,
-			   std::string& extraParams)
+			   std::string& extraParams, size_t& memoryLimit)
 {
 	auto printUsage = []()
 	{
@@ -56,6 +59,8 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 				  << "[default = not set] \n"
 				  << "  --extra-params additional config parameters "
 				  << "[default = not set] \n"
+				  << "  --memory-limit bytes\tmemory budget "
+				  << "[default = available RAM] \n"
 				  << "  --threads num_threads\tnumber of parallel threads "
 				  << "[default = 1] \n";
 	};
@@ -74,6 +79,7 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 		{"kmer", required_argument, 0, 0},
 		{"min-ovlp", required_argument, 0, 0},
 		{"extra-params", required_argument, 0, 0},
+		{"memory-limit", required_argument, 0, 0},
 		{"debug", no_argument, 0, 0},
 		{"no-scaffold", no_argument, 0, 0},
 		{0, 0, 0, 0}
@@ -111,6 +117,8 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 				configPath = optarg;
 			else if (!strcmp(longOptions[optionIndex].name, "extra-params"))
 				extraParams = optarg;
+			else if (!strcmp(longOptions[optionIndex].name, "memory-limit"))
+				memoryLimit = atoll(optarg);
 			break;
 
 		case 'h':
@@ -149,13 +157,16 @@ int contigger_main(int argc, char** argv)
 	std::string logFile;
 	std::string configPath;
 	std::string extraParams;
+	size_t memoryLimit = 0;
 	if (!parseArgs(argc, argv, readsFasta, outFolder, logFile, inGraphEdges,
 				   kmerSize, minOverlap, debugging, 
 				   numThreads, configPath, inRepeatGraph, 
-				   inReadsAlignment, noScaffold, extraParams))  return 1;
+				   inReadsAlignment, noScaffold, extraParams, memoryLimit))  return 1;
 	
 	Logger::get().setDebugging(debugging);
 	if (!logFile.empty()) Logger::get().setOutputFile(logFile);
+	if (!logFile.empty()) Profiler::get().setOutputFileNear(logFile);
+	Profiler::ScopedPhase modulePhase("contigger");
 	Logger::get().debug() << "Build date: " << __DATE__ << " " << __TIME__;
 	std::ios::sync_with_stdio(false);
 	
@@ -164,6 +175,8 @@ int contigger_main(int argc, char** argv)
 	Logger::get().debug() << "Available RAM: " 
 		<< getFreeMemorySize() / 1024 / 1024 / 1024 << " Gb";
 	Logger::get().debug() << "Total CPUs: " << std::thread::hardware_concurrency();
+	MemoryBudget::get().setLimit(memoryLimit);
+	MemoryBudget::get().logStatus();
 
 	
 	Config::load(configPath);
@@ -173,12 +186,15 @@ int contigger_main(int argc, char** argv)
 		kmerSize = Config::get("kmer_size");
 	}
 	Parameters::get().numThreads = numThreads;
+	MemoryArena::get().configure(Config::get("huge_pages"),
+								 Config::get("numa_placement"), numThreads);
 	Parameters::get().kmerSize = kmerSize;
 	Parameters::get().minimumOverlap = minOverlap;
 	Logger::get().debug() << "Running with k-mer size: " << 
 		Parameters::get().kmerSize; 
 	Logger::get().debug() << "Selected minimum overlap " << minOverlap;
 
+	Profiler::ScopedPhase stagePhase("sequence_loading");
 	Logger::get().info() << "Reading sequences";
 	SequenceContainer seqGraphEdges; 
 	SequenceContainer seqReads;
@@ -199,6 +215,7 @@ int contigger_main(int argc, char** argv)
 	seqReads.buildPositionIndex();
 	//seqAssembly.buildPositionIndex();
 
+	stagePhase.switchTo("graph_loading");
 	SequenceContainer emptyContainer;
 	RepeatGraph rg(emptyContainer, &seqGraphEdges);
 	rg.loadGraph(inRepeatGraph);
@@ -209,9 +226,11 @@ int contigger_main(int argc, char** argv)
 
 	//Logger::get().info() << "Generating contigs";
 
+	stagePhase.switchTo("contig_extension");
 	ContigExtender extender(rg, aln, emptyContainer, seqReads);
 	extender.generateUnbranchingPaths();
 	extender.generateContigs();
+	stagePhase.switchTo("output");
 	extender.outputContigs(outFolder + "/contigs.fasta");
 	extender.outputStatsTable(outFolder + "/contigs_stats.txt");
 
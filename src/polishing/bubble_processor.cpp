@@ -7,6 +7,7 @@
 #include <sys/stat.h>
 
 #include "bubble_processor.h"
+#include "../common/profiler.h"
 
 namespace
 {
@@ -102,8 +103,10 @@ void BubbleProcessor::parallelWorker()
 				_homoPolisher.polishBubble(bubble);
 			}
 			_dinucFixer.fixBubble(bubble);
+			Profiler::count("bubbles_polished");
 			_stateMutex.lock();
 		}
+		Profiler::count("bubbles");
 		
 		this->writeBubbles({bubble});
 		if (_verbose) this->writeLog({bubble});
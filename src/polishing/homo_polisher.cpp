@@ -3,7 +3,6 @@
 //Released under the BSD license (see LICENSE file)
 
 #include <algorithm>
-#include <unordered_set>
 
 #include "homo_polisher.h"
 #include "../common/matrix.h"
@@ -253,13 +252,17 @@ size_t HomoPolisher::mostLikelyLen(char nucleotide,
 	const size_t MIN_HOPO = 1;
 	const size_t MAX_HOPO = 20;
 
+	//likelihoods of all lengths are computed at once from
+	//the precomputed per-observation tables
+	std::vector<AlnScoreType> lenLikelihoods;
+	_hopoMatrix.lengthLikelihoods(nucleotide, observations, lenLikelihoods);
+	assert(lenLikelihoods.size() > MAX_HOPO);
+
 	typedef std::pair<AlnScoreType, size_t> ScorePair;
 	std::vector<ScorePair> scores;
 	for (size_t len = MIN_HOPO; len <= MAX_HOPO; ++len)
 	{
-		auto newState = HopoMatrix::State(nucleotide, len);
-		AlnScoreType likelihood = this->likelihood(newState, observations);
-		scores.push_back(std::make_pair(likelihood, len));
+		scores.push_back(std::make_pair(lenLikelihoods[len], len));
 	}
 
 	std::sort(scores.begin(), scores.end(), 
@@ -278,33 +281,24 @@ size_t HomoPolisher::compareTopTwo(char nucleotide, size_t firstChoice,
 								   observations) const
 {
 	size_t choices[] = {firstChoice, secondChoice};
-	HopoMatrix::ObsVector knownObs[2];
+	HopoMatrix::State states[] = {HopoMatrix::State(nucleotide, firstChoice),
+								  HopoMatrix::State(nucleotide, secondChoice)};
 
-	for (size_t i = 0; i < 2; ++i)
-	{
-		auto state = HopoMatrix::State(nucleotide, choices[i]);
-		knownObs[i] = _hopoMatrix.knownObservations(state);
-	}
-	
-	//getting common known observations
-	std::unordered_set<uint32_t> fstSet;
-	for (auto obs : knownObs[0]) fstSet.insert(obs.id);
-	std::unordered_set<uint32_t> commonSet;
-	for (auto obs : knownObs[1])
-	{
-		if (fstSet.count(obs.id)) commonSet.insert(obs.id);
-	}
+	//getting observations that are known for both choices
 	HopoMatrix::ObsVector commonObservations;
 	for (auto obs : observations)
 	{
-		if (commonSet.count(obs.id)) commonObservations.push_back(obs);
+		if (_hopoMatrix.isKnownObservation(states[0], obs) &&
+			_hopoMatrix.isKnownObservation(states[1], obs))
+		{
+			commonObservations.push_back(obs);
+		}
 	}
 
 	AlnScoreType likelihoods[2];
 	for (size_t i = 0; i < 2; ++i)
 	{
-		auto state = HopoMatrix::State(nucleotide, choices[i]);
-		likelihoods[i] = this->likelihood(state, commonObservations);
+		likelihoods[i] = this->likelihood(states[i], commonObservations);
 	}
 
 	return (likelihoods[0] > likelihoods[1]) ? choices[0] : choices[1];
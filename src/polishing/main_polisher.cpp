@@ -8,6 +8,7 @@
 #include <cstring>
 
 #include "../polishing/bubble_processor.h"
+#include "../common/profiler.h"
 
 
 bool parseArgs(int argc, char** argv, std::string& bubblesFile, 
@@ -105,6 +106,9 @@ int polisher_main(int argc, char* argv[])
 				   quiet, enableHopo))
 		return 1;
 
+	Profiler::get().setOutputFileNear(outConsensus);
+	Profiler::ScopedPhase modulePhase("polisher");
+
 	BubbleProcessor bp(scoringMatrix, hopoMatrix, !quiet, enableHopo);
 	if (!outVerbose.empty())
 		bp.enableVerboseOutput(outVerbose);
@@ -45,7 +45,9 @@ namespace
 	static const size_t MIN_HOPO = 1;
 	static const size_t MAX_HOPO = 20;
 	static const size_t NUM_HOPO_STATES = 128;
-	static const size_t NUM_HOPO_OBS = 65536;
+	//observation id packs two run counts (each capped by MAX_HOPO)
+	//into 4-bit shifted fields, see HopoMatrix::strToObs
+	static const size_t NUM_HOPO_OBS = (MAX_HOPO << 4) + MAX_HOPO + 1;
 	static const double MIN_HOPO_PROB = 0.001f;
 	static const double ZERO_HOPO_PROB = 0.0000000001f;
 
@@ -211,27 +213,43 @@ std::string HopoMatrix::obsToStr(HopoMatrix::Observation obs)
 
 HopoMatrix::HopoMatrix(const std::string& fileName)
 {
-	for (size_t i = 0; i < NUM_HOPO_STATES; ++i)
-	{
-		_observationProbs.emplace_back(NUM_HOPO_OBS, probToScore(MIN_HOPO_PROB));
-	}
+	static_assert(NUM_HOPO_STATES == STATES_STRIDE, 
+				  "Hopo table stride should cover all states");
+	_observationProbs.assign(NUM_HOPO_OBS * NUM_HOPO_STATES, 
+							 probToScore(MIN_HOPO_PROB));
 	_genomeProbs.assign(NUM_HOPO_STATES, probToScore(MIN_HOPO_PROB));
 	this->loadMatrix(fileName);
 }
 
 
-//returns all observations from the training set for a given state
-HopoMatrix::ObsVector HopoMatrix::knownObservations(State state) const
+//checks if the observation was present in the training set for a given state
+bool HopoMatrix::isKnownObservation(State state, Observation observ) const
 {
-	ObsVector obsVector;
-	for (uint32_t obsId = 0; obsId < NUM_HOPO_OBS; ++obsId)
+	return this->getObsProb(state, observ) > probToScore(MIN_HOPO_PROB);
+}
+
+//computes likelihoods of all homopolymer lengths (indexed by length,
+//from 0 to MAX_HOPO) of a given nucleotide in a single pass over the
+//exact-match observations. Scores of all lengths for an observation
+//are contiguous in the table, so the inner loop is vectorized
+void HopoMatrix::lengthLikelihoods(char nucl, const ObsVector& observations,
+								   std::vector<AlnScoreType>& likelihoods) const
+{
+	const size_t firstState = State(nucl, 0).id;
+	likelihoods.assign(_genomeProbs.begin() + firstState, 
+					   _genomeProbs.begin() + firstState + MAX_HOPO + 1);
+	AlnScoreType* __restrict outRow = likelihoods.data();
+	for (auto obs : observations)
 	{
-		if (_observationProbs[state.id][obsId] > probToScore(MIN_HOPO_PROB))
+		if (!obs.extactMatch) continue;
+
+		const AlnScoreType* __restrict obsRow = 
+			&_observationProbs[obs.id * STATES_STRIDE + firstState];
+		for (size_t len = 0; len <= MAX_HOPO; ++len)
 		{
-			obsVector.emplace_back(obsId);
+			outRow[len] += obsRow[len];
 		}
 	}
-	return obsVector;
 }
 
 //loads homopolymer matrix from .mat file
@@ -289,7 +307,7 @@ void HopoMatrix::loadMatrix(const std::string& fileName)
 			for (size_t j = 0; j < NUM_HOPO_OBS; ++j)
 			{
 				double prob = (double)observationsFreq[state.id][j] / sumFreq;
-				_observationProbs[state.id][j] = 
+				_observationProbs[j * STATES_STRIDE + state.id] = 
 									probToScore(std::max(prob, MIN_HOPO_PROB));
 			}
 		}
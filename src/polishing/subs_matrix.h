@@ -69,10 +69,12 @@ public:
 
 	HopoMatrix(const std::string& fileName);
 	AlnScoreType getObsProb(State state, Observation observ) const
-		{return _observationProbs[state.id][observ.id];}
+		{return _observationProbs[observ.id * STATES_STRIDE + state.id];}
 	AlnScoreType getGenomeProb(State state) const
 		{return _genomeProbs[state.id];}
-	ObsVector knownObservations(State state) const;
+	bool isKnownObservation(State state, Observation observ) const;
+	void lengthLikelihoods(char nucl, const ObsVector& observations,
+						   std::vector<AlnScoreType>& likelihoods) const;
 	static Observation strToObs(char mainNucl, const std::string& dnaStr, 
 								size_t start = 0, 
 								size_t end = std::string::npos);
@@ -81,6 +83,10 @@ public:
 private:
 	void loadMatrix(const std::string& filaName);
 
-	std::vector<std::vector<AlnScoreType>> _observationProbs;
+	//observation probabilities are stored in a flat observation-major
+	//table, so that the scores of all lengths of a homopolymer for
+	//a given observation occupy a contiguous block
+	static const size_t STATES_STRIDE = 128;
+	std::vector<AlnScoreType> _observationProbs;
 	std::vector<AlnScoreType> 			   _genomeProbs;
 };
@@ -229,7 +229,7 @@ int HaplotypeResolver::findHeterozygousLoops()
 
 HaplotypeResolver::VariantPaths 
 	HaplotypeResolver::findVariantSegment(GraphEdge* startEdge,
-										  const std::vector<GraphAlignment>& alingnments,
+										  const AlignmentIndex::Range& alingnments,
 										  const std::unordered_set<GraphEdge*>& loopedEdges)
 {
 	//first, extract alnignment paths starting from
@@ -484,7 +484,7 @@ HaplotypeResolver::VariantPaths
 //(more than just two alternative branches) using read-paths
 int HaplotypeResolver::findRoundabouts()
 {
-	auto alnIndex = _aligner.makeAlignmentIndex();
+	const auto& alnIndex = _aligner.getAlignmentIndex();
 
 	GraphProcessor proc(_graph, _asmSeqs);
 	auto unbranchingPaths = proc.getUnbranchingPaths();
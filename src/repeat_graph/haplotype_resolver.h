@@ -48,7 +48,7 @@ private:
 	};
 
 	VariantPaths findVariantSegment(GraphEdge* startEdge, 
-									const std::vector<GraphAlignment>& alnignments,
+									const AlignmentIndex::Range& alnignments,
 									const std::unordered_set<GraphEdge*>& loopedEdges);
 
 	RepeatGraph& _graph;
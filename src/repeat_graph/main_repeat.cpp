@@ -13,6 +13,9 @@
 #include "../common/logger.h"
 #include "../common/utils.h"
 #include "../common/memory_info.h"
+#include "../common/memory_budget.h"
+#include "../common/arena_allocator.h"
+#include "../common/profiler.h"
 
 #include "../repeat_graph/repeat_graph.h"
 #include "../repeat_graph/multiplicity_inferer.h"
@@ -28,7 +31,7 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 			   std::string& inAssembly, int& kmerSize,
 			   int& minOverlap, bool& debug, size_t& numThreads, 
 			   std::string& configPath, bool& unevenCov,
-			   bool& keepHaplotypes, std::string& extraParams)
+			   bool& keepHaplotypes, std::string& extraParams, size_t& memoryLimit)
 {
 	auto printUsage = []()
 	{
@@ -55,6 +58,8 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 				  << "[default = not set] \n"
 				  << "  --extra-params additional config parameters "
 				  << "[default = not set] \n"
+				  << "  --memory-limit bytes\tmemory budget "
+				  << "[default = available RAM] \n"
 				  << "  --threads num_threads\tnumber of parallel threads "
 				  << "[default = 1] \n";
 	};
@@ -71,6 +76,7 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 		{"kmer", required_argument, 0, 0},
 		{"min-ovlp", required_argument, 0, 0},
 		{"extra-params", required_argument, 0, 0},
+		{"memory-limit", required_argument, 0, 0},
 		{"meta", no_argument, 0, 0},
 		{"keep-haplotypes", no_argument, 0, 0},
 		{"debug", no_argument, 0, 0},
@@ -107,6 +113,8 @@ bool parseArgs(int argc, char** argv, std::string& readsFasta,
 				configPath = optarg;
 			else if (!strcmp(longOptions[optionIndex].name, "extra-params"))
 				extraParams = optarg;
+			else if (!strcmp(longOptions[optionIndex].name, "memory-limit"))
+				memoryLimit = atoll(optarg);
 			break;
 
 		case 'h':
@@ -143,12 +151,15 @@ int repeat_main(int argc, char** argv)
 	std::string logFile;
 	std::string configPath;
 	std::string extraParams;
+	size_t memoryLimit = 0;
 	if (!parseArgs(argc, argv, readsFasta, outFolder, logFile, inAssembly,
 				   kmerSize, minOverlap, debugging, 
-				   numThreads, configPath, isMeta, keepHaplotypes, extraParams))  return 1;
+				   numThreads, configPath, isMeta, keepHaplotypes, extraParams, memoryLimit))  return 1;
 	
 	Logger::get().setDebugging(debugging);
 	if (!logFile.empty()) Logger::get().setOutputFile(logFile);
+	if (!logFile.empty()) Profiler::get().setOutputFileNear(logFile);
+	Profiler::ScopedPhase modulePhase("repeat");
 	Logger::get().debug() << "Build date: " << __DATE__ << " " << __TIME__;
 	std::ios::sync_with_stdio(false);
 	
@@ -157,6 +168,8 @@ int repeat_main(int argc, char** argv)
 	Logger::get().debug() << "Available RAM: " 
 		<< getFreeMemorySize() / 1024 / 1024 / 1024 << " Gb";
 	Logger::get().debug() << "Total CPUs: " << std::thread::hardware_concurrency();
+	MemoryBudget::get().setLimit(memoryLimit);
+	MemoryBudget::get().logStatus();
 
 	Config::load(configPath);
 	if (!extraParams.empty()) Config::addParameters(extraParams);
@@ -165,6 +178,8 @@ int repeat_main(int argc, char** argv)
 		kmerSize = Config::get("kmer_size");
 	}
 	Parameters::get().numThreads = numThreads;
+	MemoryArena::get().configure(Config::get("huge_pages"),
+								 Config::get("numa_placement"), numThreads);
 	Parameters::get().kmerSize = kmerSize;
 	Parameters::get().minimumOverlap = minOverlap;
 	Parameters::get().unevenCoverage = isMeta;
@@ -173,6 +188,7 @@ int repeat_main(int argc, char** argv)
 	Logger::get().debug() << "Selected minimum overlap " << minOverlap;
 	Logger::get().debug() << "Metagenome mode: " << "NY"[isMeta];
 
+	Profiler::ScopedPhase stagePhase("disjointig_loading");
 	Logger::get().info() << "Parsing disjointigs";
 	SequenceContainer seqAssembly;
 	std::vector<std::string> readsList = splitString(readsFasta, ',');
@@ -186,13 +202,16 @@ int repeat_main(int argc, char** argv)
 		return 1;
 	}
 	seqAssembly.buildPositionIndex();
+	if ((bool)Config::get("hpc_scoring_on")) seqAssembly.buildHpcIndex();
 
+	stagePhase.switchTo("graph_construction");
 	Logger::get().info() << "Building repeat graph";
 	SequenceContainer edgeSequences;
 	RepeatGraph rg(seqAssembly, &edgeSequences);
 	rg.build();
 	//rg.validateGraph();
 
+	stagePhase.switchTo("read_loading");
 	Logger::get().info() << "Parsing reads";
 	SequenceContainer seqReads;
 	try
@@ -210,6 +229,7 @@ int repeat_main(int argc, char** argv)
 	//graph are stored in a continious chunk of memory.
 	rg.updateEdgeSequences();
 
+	stagePhase.switchTo("read_alignment");
 	Logger::get().info() << "Aligning reads to the graph";
 	ReadAligner aligner(rg, seqReads);
 	aligner.alignReads();
@@ -217,6 +237,7 @@ int repeat_main(int argc, char** argv)
 	multInf.estimateCoverage();
 	//aligner.storeAlignments(outFolder + "/read_alignment_before_rr");
 
+	stagePhase.switchTo("repeat_resolution");
 	Logger::get().info() << "Simplifying the graph";
 
 	multInf.removeUnsupportedEdges(/*only tips*/ true);
@@ -297,6 +318,7 @@ int repeat_main(int argc, char** argv)
 	repResolver.finalizeGraph();
 	//rg.validateGraph();
 
+	stagePhase.switchTo("output");
 	outGen.outputDot(proc.getEdgesPaths(), outFolder + "/graph_after_rr.gv");
 	rg.storeGraph(outFolder + "/repeat_graph_dump");
 	aligner.storeAlignments(outFolder + "/read_alignment_dump");
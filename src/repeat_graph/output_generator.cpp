@@ -4,85 +4,127 @@
 
 #include "output_generator.h"
 #include "../sequence/consensus_generator.h"
+#include "../common/parallel.h"
 #include <iomanip>
+#include <numeric>
 
 
-//Generates FASTA from the given graph paths
-std::vector<FastaRecord> OutputGenerator::
-	generatePathSequences(const std::vector<UnbranchingPath>& paths) const
+//As each edge might correspond to multiple sequences,
+//we need to select them so as to minimize the
+//number of original contigs (that were used to build the graph)
+std::vector<FastaRecord::Id> 
+	OutputGenerator::selectSegments(const UnbranchingPath& contig) const
 {
-	std::vector<FastaRecord> contigSequences;
-
-	for (auto& contig : paths)
+	std::unordered_map<FastaRecord::Id, int> seqIdFreq;
+	for (auto& edge : contig.path) 
 	{
-		//As each edge might correspond to multiple sequences,
-		//we need to select them so as to minimize the
-		//number of original contigs (that were used to build the graph)
-		std::unordered_map<FastaRecord::Id, int> seqIdFreq;
-		for (auto& edge : contig.path) 
+		std::unordered_set<FastaRecord::Id> edgeSeqIds;
+		for (auto& seg: edge->seqSegments) 
 		{
-			std::unordered_set<FastaRecord::Id> edgeSeqIds;
-			for (auto& seg: edge->seqSegments) 
-			{
-				edgeSeqIds.insert(seg.origSeqId);
-			}
-			for (auto& seqId : edgeSeqIds)
-			{
-				seqIdFreq[seqId] += 1;
-			}
+			edgeSeqIds.insert(seg.origSeqId);
 		}
+		for (auto& seqId : edgeSeqIds)
+		{
+			seqIdFreq[seqId] += 1;
+		}
+	}
 
-		std::string nucSequence;
-		//ContigPath contigPath;
-		//contigPath.name = contig.name();
-		//int32_t prevFlank = 0;
-		//int32_t prevSubLength = 0;
-
-		for (size_t i = 0; i < contig.path.size(); ++i) 
+	std::vector<FastaRecord::Id> segments;
+	for (size_t i = 0; i < contig.path.size(); ++i) 
+	{
+		if (contig.path[i]->seqSegments.empty()) 
 		{
-			if (contig.path[i]->seqSegments.empty()) 
-			{
-				throw std::runtime_error("Edge without sequence");
-			}
+			throw std::runtime_error("Edge without sequence");
+		}
 
-			//get the sequence with maximum frequency
-			EdgeSequence* bestSegment = nullptr;
-			for (auto& seg : contig.path[i]->seqSegments)
+		//get the sequence with maximum frequency
+		EdgeSequence* bestSegment = nullptr;
+		for (auto& seg : contig.path[i]->seqSegments)
+		{
+			if (!bestSegment || 
+				seqIdFreq[seg.origSeqId] > seqIdFreq[bestSegment->origSeqId])
 			{
-				if (!bestSegment || 
-					seqIdFreq[seg.origSeqId] > seqIdFreq[bestSegment->origSeqId])
-				{
-					bestSegment = &seg;
-				}
+				bestSegment = &seg;
 			}
-			if (bestSegment->seqLen == 0) continue;
-			nucSequence += _graph.edgeSequences()
-								.getSeq(bestSegment->edgeSeqId).str();
 		}
-		//contigParts.push_back(contigPath);
-		contigSequences.push_back({DnaSequence(nucSequence), contig.name(), 
-								  FastaRecord::ID_NONE});
+		if (bestSegment->seqLen == 0) continue;
+		segments.push_back(bestSegment->edgeSeqId);
 	}
+	return segments;
+}
+
+//concatenates the packed edge sequences, paths are processed in parallel
+std::vector<FastaRecord> OutputGenerator::
+	concatenateSegments(const std::vector<std::string>& names,
+						const std::vector<std::vector<FastaRecord::Id>>& segments) const
+{
+	std::vector<FastaRecord> contigSequences(names.size());
+	std::function<void(const size_t&)> concatFun =
+	[this, &names, &segments, &contigSequences] (const size_t& contigId)
+	{
+		DnaSequence sequence;
+		for (auto& segId : segments[contigId])
+		{
+			sequence.append(_graph.edgeSequences().getSeq(segId));
+		}
+		contigSequences[contigId] = FastaRecord(sequence, names[contigId],
+												FastaRecord::ID_NONE);
+	};
+	std::vector<size_t> tasks(names.size());
+	std::iota(tasks.begin(), tasks.end(), 0);
+	processInParallel(tasks, concatFun, Parameters::get().numThreads, false);
 
 	return contigSequences;
 }
 
-void OutputGenerator::outputFasta(const std::vector<UnbranchingPath>& paths,
-								  const std::string& filename)
+//Generates FASTA from the given graph paths
+std::vector<FastaRecord> OutputGenerator::
+	generatePathSequences(const std::vector<UnbranchingPath>& paths) const
 {
-	std::vector<UnbranchingPath> posStrandPaths;
-	for (auto& path : paths)
+	std::vector<std::string> names;
+	std::vector<std::vector<FastaRecord::Id>> segments;
+	for (auto& contig : paths)
 	{
-		if (path.id.strand()) posStrandPaths.push_back(path);
+		names.push_back(contig.name());
+		segments.push_back(this->selectSegments(contig));
 	}
-	SequenceContainer::writeFasta(this->generatePathSequences(posStrandPaths), 
+	return this->concatenateSegments(names, segments);
+}
+
+//Sequences of the positive strand paths. They are reused by the 
+//subsequent output calls, unless the paths or the selected edge 
+//sequences have changed (edge sequences themselves are never modified)
+const std::vector<FastaRecord>& OutputGenerator::
+	getPositivePathSequences(const std::vector<UnbranchingPath>& paths)
+{
+	std::vector<std::string> names;
+	std::vector<std::vector<FastaRecord::Id>> segments;
+	for (auto& contig : paths)
+	{
+		if (!contig.id.strand()) continue;
+		names.push_back(contig.name());
+		segments.push_back(this->selectSegments(contig));
+	}
+	if (names != _cachedNames || segments != _cachedSegments)
+	{
+		_cachedSequences = this->concatenateSegments(names, segments);
+		_cachedNames = std::move(names);
+		_cachedSegments = std::move(segments);
+	}
+	return _cachedSequences;
+}
+
+void OutputGenerator::outputFasta(const std::vector<UnbranchingPath>& paths,
+								  const std::string& filename)
+{
+	SequenceContainer::writeFasta(this->getPositivePathSequences(paths), 
 								  filename);
 }
 
 void OutputGenerator::outputGfa(const std::vector<UnbranchingPath>& paths,
 							    const std::string& filename)
 {
-	auto sequences = this->generatePathSequences(paths);
+	const auto& sequences = this->getPositivePathSequences(paths);
 	std::unordered_map<GraphEdge*, const UnbranchingPath*> edgeToPath;
 	for (auto& path : paths)
 	{
@@ -94,15 +136,18 @@ void OutputGenerator::outputGfa(const std::vector<UnbranchingPath>& paths,
 	Logger::get().debug() << "Writing Gfa";
 	FILE* fout = fopen(filename.c_str(), "w");
 	if (!fout) throw std::runtime_error("Can't open " + filename);
+	setvbuf(fout, nullptr, _IOFBF, 1024 * 1024);
 
 	fprintf(fout, "H\tVN:Z:1.0\n");
+	size_t seqId = 0;
 	for (size_t i = 0; i < paths.size(); ++i)
 	{
 		if (!paths[i].id.strand()) continue;
 
 		//size_t kmerCount = sequences[i].sequence.length() * paths[i].meanCoverage;
-		fprintf(fout, "S\t%s\t%s\tdp:i:%d\n", paths[i].name().c_str(), 
-				sequences[i].sequence.str().c_str(), (int)paths[i].meanCoverage);
+		fprintf(fout, "S\t%s\t", paths[i].name().c_str());
+		SequenceContainer::writeSequence(sequences[seqId++].sequence, fout);
+		fprintf(fout, "\tdp:i:%d\n", (int)paths[i].meanCoverage);
 	}
 
 	//make sure that if there are nodes with one incoming and one outgoing
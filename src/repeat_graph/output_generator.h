@@ -30,6 +30,18 @@ public:
 	std::vector<FastaRecord> 
 		generatePathSequences(const std::vector<UnbranchingPath>& paths) const;
 private:
+	std::vector<FastaRecord::Id> 
+		selectSegments(const UnbranchingPath& contig) const;
+	std::vector<FastaRecord> 
+		concatenateSegments(const std::vector<std::string>& names,
+							const std::vector<std::vector<FastaRecord::Id>>& 
+								segments) const;
+	const std::vector<FastaRecord>&
+		getPositivePathSequences(const std::vector<UnbranchingPath>& paths);
+
+	std::vector<std::string> _cachedNames;
+	std::vector<std::vector<FastaRecord::Id>> _cachedSegments;
+	std::vector<FastaRecord> _cachedSequences;
 
 	RepeatGraph& _graph;
 	const ReadAligner& _aligner;
@@ -8,19 +8,31 @@
 #include <cmath>
 #include <iomanip>
 #include <queue>
+#include <numeric>
+#include <atomic>
 
 namespace
 {
+	//chains that extend the same chain share its prefix,
+	//so each link only points to the previous one
+	struct ChainLink
+	{
+		const EdgeAlignment* aln;
+		int32_t prev;
+	};
+
 	struct Chain
 	{
-		std::vector<const EdgeAlignment*> aln;
+		const EdgeAlignment* front;
+		int32_t lastLink;
 		int32_t score;
 	};
 }
 
 //Give alignments to separate edges for a single read, merges them
 //into non-overlapping chains (could be more than one chain per read
-//in case of chimera) with maximum score
+//in case of chimera) with maximum score. Alignments should be sorted
+//by the read start coordinate
 std::vector<GraphAlignment>
 	ReadAligner::chainReadAlignments(const std::vector<EdgeAlignment>& ovlps) const
 {
@@ -29,12 +41,38 @@ std::vector<GraphAlignment>
 	static const int32_t MIN_ALN = Parameters::get().minimumOverlap;
 	static const int32_t MAX_SEP = (int)Config::get("max_separation");
 
-	std::deque<Chain> activeChains;
-	std::deque<Chain> frozenChains;
+	std::vector<ChainLink> links;
+	std::vector<Chain> chains;		//in the order of creation
+	std::vector<bool> isActive;
+	size_t numActive = 0;
+	std::vector<size_t> frozenChains;
+
+	//active chains that could be extended, grouped by their right node
+	std::unordered_map<GraphNode*, std::vector<size_t>> chainsByNode;
+
+	//active chains that ended more than MAX_JUMP before the current
+	//alignment are outdated. Since the alignments are sorted, they
+	//will remain outdated, and are found using the heap of chain ends
+	typedef std::pair<int32_t, size_t> ChainEnd;
+	std::priority_queue<ChainEnd, std::vector<ChainEnd>, 
+						std::greater<ChainEnd>> chainEnds;
+	std::vector<size_t> outdatedChains;
+
+	auto lastAln = [&links, &chains](size_t chainId)
+		{return links[chains[chainId].lastLink].aln;};
+
 	for (auto& edgeAlignment : ovlps)
 	{
+		const OverlapRange& nextOvlp = edgeAlignment.overlap;
+		while (!chainEnds.empty() && 
+			   nextOvlp.curBegin - chainEnds.top().first > MAX_JUMP)
+		{
+			outdatedChains.push_back(chainEnds.top().second);
+			chainEnds.pop();
+		}
+
 		int32_t maxScore = 0;
-		Chain* maxChain = nullptr;
+		int32_t maxChain = -1;
 		int numOutdated = 0;
 
 		bool canExtend = edgeAlignment.overlap.extBegin < MAX_JUMP;
@@ -43,92 +81,97 @@ std::vector<GraphAlignment>
 
 		if (canExtend)
 		{
-			for (auto& chain : activeChains)
+			numOutdated = outdatedChains.size();
+
+			//candidates are checked in the order of creation, so the
+			//earliest of the equally scored chains is extended. Chains that
+			//were frozen, or are too far behind, are removed from the list
+			auto& candidates = chainsByNode[edgeAlignment.edge->nodeLeft];
+			size_t insertIdx = 0;
+			for (size_t chainId : candidates)
 			{
-				const OverlapRange& nextOvlp = edgeAlignment.overlap;
-				const OverlapRange& prevOvlp = chain.aln.back()->overlap;
-
+				const OverlapRange& prevOvlp = lastAln(chainId)->overlap;
 				int32_t readDiff = nextOvlp.curBegin - prevOvlp.curEnd;
+				if (!isActive[chainId] || readDiff >= MAX_JUMP) continue;
+				candidates[insertIdx++] = chainId;
+
 				int32_t graphLeftDiff = nextOvlp.extBegin;
 				int32_t graphRightDiff = prevOvlp.extLen - prevOvlp.extEnd;
-
-				if (chain.aln.back()->edge->nodeRight == edgeAlignment.edge->nodeLeft &&
-					MAX_JUMP > readDiff && readDiff > -MAX_READ_OVLP &&
+				if (readDiff > -MAX_READ_OVLP &&
 					graphLeftDiff + graphRightDiff < MAX_JUMP)
 				{
 					int32_t jumpDiv = abs(readDiff - (graphLeftDiff + graphRightDiff));
 					int32_t gapCost = (jumpDiv > 100) ? jumpDiv / 50 : 0;
-					int32_t score = chain.score + nextOvlp.score - gapCost;
+					int32_t score = chains[chainId].score + nextOvlp.score - gapCost;
 					if (score > maxScore)
 					{
 						maxScore = score;
-						maxChain = &chain;
+						maxChain = chainId;
 					}
 				}
-
-				if (readDiff > MAX_JUMP) ++numOutdated;
 			}
+			candidates.resize(insertIdx);
 		}
 
-		//found chain to continue
-		if (maxChain)
+		//found chain to continue (the extended chain is kept as well)
+		if (maxChain >= 0)
 		{
-			activeChains.push_back(*maxChain);		//add a copy of the extended chain
-			activeChains.back().aln.push_back(&edgeAlignment);
-			activeChains.back().score = maxScore;
+			links.push_back({&edgeAlignment, chains[maxChain].lastLink});
+			chains.push_back({chains[maxChain].front, 
+							  (int32_t)links.size() - 1, maxScore});
 		}
 		//can't continue, create a new chain
 		else
 		{
-			if (canBeExtended)
-			{
-				activeChains.push_back({{&edgeAlignment}, 
-										 edgeAlignment.overlap.score});
-			}
-			else
-			{
-				frozenChains.push_back({{&edgeAlignment}, 
-										 edgeAlignment.overlap.score});
-			}
+			links.push_back({&edgeAlignment, -1});
+			chains.push_back({&edgeAlignment, (int32_t)links.size() - 1,
+							  edgeAlignment.overlap.score});
+		}
+		size_t newChain = chains.size() - 1;
+		isActive.push_back(maxChain >= 0 || canBeExtended);
+		if (isActive.back())
+		{
+			++numActive;
+			chainsByNode[edgeAlignment.edge->nodeRight].push_back(newChain);
+			chainEnds.push({nextOvlp.curEnd, newChain});
+		}
+		else
+		{
+			frozenChains.push_back(newChain);
 		}
 
 		//cleaning up if too much outdated chains
-		if (numOutdated > (int)activeChains.size() / 2)
+		if (numOutdated > (int)numActive / 2)
 		{
-			auto itInsert = activeChains.begin();
-			auto itCur = activeChains.begin();
-			while(itCur != activeChains.end())
+			std::sort(outdatedChains.begin(), outdatedChains.end());
+			for (size_t chainId : outdatedChains)
 			{
-				bool outdated = edgeAlignment.overlap.curBegin - 
-								itCur->aln.back()->overlap.curEnd > MAX_JUMP;
-				if (outdated)
-				{
-					frozenChains.push_back(*itCur);
-				}
-				else
-				{
-					if (itInsert != itCur) *itInsert = *itCur;
-					++itInsert;
-				}
-				++itCur;
+				isActive[chainId] = false;
+				frozenChains.push_back(chainId);
 			}
-			activeChains.erase(itInsert, activeChains.end());
+			numActive -= outdatedChains.size();
+			outdatedChains.clear();
 		}
 	}
 
-	activeChains.insert(activeChains.end(), frozenChains.begin(), 
+	std::vector<size_t> sortedChains;
+	for (size_t i = 0; i < chains.size(); ++i)
+	{
+		if (isActive[i]) sortedChains.push_back(i);
+	}
+	sortedChains.insert(sortedChains.end(), frozenChains.begin(), 
 						frozenChains.end());	
-	std::sort(activeChains.begin(), activeChains.end(),
-			  [](const Chain& c1, const Chain& c2)
-			  {return c1.score > c2.score;});
+	std::sort(sortedChains.begin(), sortedChains.end(),
+			  [&chains](size_t c1, size_t c2)
+			  {return chains[c1].score > chains[c2].score;});
 
 	//greedily choose non-intersecting set of alignments
 	std::vector<GraphAlignment> acceptedAlignments;
-	for (auto& chain : activeChains)
+	for (size_t chainId : sortedChains)
 	{
-		int32_t alnLen = chain.aln.back()->overlap.curEnd - 
-					 	 chain.aln.front()->overlap.curBegin;
-		if (alnLen < MIN_ALN) continue;
+		int32_t curStart = chains[chainId].front->overlap.curBegin;
+		int32_t curEnd = lastAln(chainId)->overlap.curEnd;
+		if (curEnd - curStart < MIN_ALN) continue;
 
 		//check if it overlaps with other accepted chains
 		bool overlaps = false;
@@ -136,8 +179,6 @@ std::vector<GraphAlignment>
 		{
 			int32_t existStart = existAln.front().overlap.curBegin;
 			int32_t existEnd = existAln.back().overlap.curEnd;
-			int32_t curStart = chain.aln.front()->overlap.curBegin;
-			int32_t curEnd = chain.aln.back()->overlap.curEnd;
 
 			int32_t overlapRate = std::min(curEnd, existEnd) - 
 									std::max(curStart, existStart);
@@ -146,7 +187,13 @@ std::vector<GraphAlignment>
 		if (!overlaps) 
 		{
 			acceptedAlignments.emplace_back();
-			for (auto& aln : chain.aln) acceptedAlignments.back().push_back(*aln);
+			for (int32_t link = chains[chainId].lastLink; link >= 0; 
+				 link = links[link].prev)
+			{
+				acceptedAlignments.back().push_back(*links[link].aln);
+			}
+			std::reverse(acceptedAlignments.back().begin(), 
+						 acceptedAlignments.back().end());
 		}
 	}
 
@@ -209,11 +256,18 @@ void ReadAligner::alignReads()
 	int64_t alignedLength = 0;
 	OvlpDivStats divergenceStats;
 
-	std::function<void(const FastaRecord::Id&)> alignRead = 
-	[this, &indexMutex, &numAligned, &readsOverlaps,
+	//chains are stored per read and added in the order of reads,
+	//so the result does not depend on the thread scheduling
+	std::vector<std::vector<GraphAlignment>> chainsByRead(allQueries.size());
+	std::vector<size_t> queryIds(allQueries.size());
+	std::iota(queryIds.begin(), queryIds.end(), 0);
+
+	std::function<void(const size_t&)> alignRead = 
+	[this, &indexMutex, &numAligned, &readsOverlaps, &allQueries, &chainsByRead,
 		&idToSegment, &alignedLength, &alignedInFull, &divergenceStats] 
-	(const FastaRecord::Id& seqId)
+	(const size_t& queryId)
 	{
+		const FastaRecord::Id& seqId = allQueries[queryId];
 		auto overlaps = readsOverlaps.quickSeqOverlaps(seqId);
 		std::vector<EdgeAlignment> alignments;
 		for (auto& ovlp : overlaps)
@@ -268,22 +322,31 @@ void ReadAligner::alignReads()
 		if (goodChains.size() == 1) ++alignedInFull;
 		for (auto& chain : goodChains) 
 		{
-			chain.shrink_to_fit();
-			_readAlignments.push_back(chain);
 			alignedLength += chain.back().overlap.curEnd - 
 							 chain.front().overlap.curBegin;
 		}
-		for (auto& chain : complChains)
-		{
-			chain.shrink_to_fit();
-			_readAlignments.push_back(chain);
-		}
 		indexMutex.unlock();
 		/////
+
+		auto& storedChains = chainsByRead[queryId];
+		for (auto* chains : {&goodChains, &complChains})
+		{
+			for (auto& chain : *chains)
+			{
+				chain.shrink_to_fit();
+				storedChains.push_back(std::move(chain));
+			}
+		}
 	};
 
-	processInParallel(allQueries, alignRead, 
+	processInParallel(queryIds, alignRead, 
 					  Parameters::get().numThreads, true);
+	for (auto& chains : chainsByRead)
+	{
+		for (auto& chain : chains) _readAlignments.push_back(std::move(chain));
+		chains = std::vector<GraphAlignment>();
+	}
+	_alnIndexValid = false;
 
 	Logger::get().debug() << "Total reads : " << allQueries.size();
 	Logger::get().debug() << "Read with aligned parts : " << numAligned;
@@ -345,6 +408,12 @@ void ReadAligner::updateAlignments()
 			splitAlignment(_readAlignments[i]);
 		}
 	}
+	//the alignments that were not changed keep their positions,
+	//so the index is still valid if there were no changes at all
+	if (insertIdx != _readAlignments.size() || !newlyAdded.empty())
+	{
+		_alnIndexValid = false;
+	}
 	_readAlignments.erase(_readAlignments.begin() + insertIdx, _readAlignments.end());
 	_readAlignments.reserve(_readAlignments.size() + newlyAdded.size());
 	for (auto& aln : newlyAdded)
@@ -381,6 +450,7 @@ void ReadAligner::loadAlignments(const std::string& filename)
 		throw std::runtime_error("Can't open "  + filename);
 	}
 
+	_alnIndexValid = false;
 	GraphAlignment curAlignment;
 	while(true)
 	{
@@ -425,27 +495,112 @@ void ReadAligner::loadAlignments(const std::string& filename)
 	this->updateAlignments();
 }
 
-ReadAligner::AlnIndex ReadAligner::makeAlignmentIndex()
+const AlignmentIndex& ReadAligner::getAlignmentIndex() const
 {
-	AlnIndex alnIndex;
-	for (auto& aln : this->getAlignments())
+	if (!_alnIndexValid)
 	{
-		if (aln.size() > 1)
+		_alnIndex.build(_readAlignments);
+		_alnIndexValid = true;
+	}
+	return _alnIndex;
+}
+
+void AlignmentIndex::clear()
+{
+	_alignments = nullptr;
+	_offsets = std::vector<size_t>();
+	_alnIds = std::vector<uint32_t>();
+}
+
+//two passes over the alignments (counting edge occurences, then
+//filling the buckets), both parallel. Buckets are filled in arbitrary
+//order, and are sorted afterwards, so the result is deterministic
+void AlignmentIndex::build(const std::vector<GraphAlignment>& alignments)
+{
+	const size_t CHUNK = 1024;
+	this->clear();
+	_alignments = &alignments;
+
+	size_t numEdgeIds = 0;
+	for (auto& aln : alignments)
+	{
+		for (auto& edgeAln : aln)
 		{
-			std::unordered_set<GraphEdge*> uniqueEdges;
-			for (auto& edgeAln : aln)
+			numEdgeIds = std::max(numEdgeIds, edgeAln.edge->edgeId.index() + 1);
+		}
+	}
+
+	std::vector<size_t> alnChunks;
+	for (size_t i = 0; i < alignments.size(); i += CHUNK) alnChunks.push_back(i);
+
+	//each alignment is counted once per edge, even if
+	//the edge is visited multiple times
+	auto forEachEdge = [&alignments, CHUNK](size_t chunkStart, 
+									std::function<void(size_t, size_t)> fun)
+	{
+		std::vector<size_t> edgeIds;
+		size_t chunkEnd = std::min(chunkStart + CHUNK, alignments.size());
+		for (size_t alnId = chunkStart; alnId < chunkEnd; ++alnId)
+		{
+			if (alignments[alnId].size() < 2) continue;
+			edgeIds.clear();
+			for (auto& edgeAln : alignments[alnId])
 			{
-				uniqueEdges.insert(edgeAln.edge);
+				edgeIds.push_back(edgeAln.edge->edgeId.index());
 			}
-			for (GraphEdge* edge : uniqueEdges) alnIndex[edge].push_back(aln);
+			std::sort(edgeIds.begin(), edgeIds.end());
+			edgeIds.erase(std::unique(edgeIds.begin(), edgeIds.end()), 
+						  edgeIds.end());
+			for (size_t edgeIdx : edgeIds) fun(edgeIdx, alnId);
 		}
+	};
+
+	std::vector<std::atomic<size_t>> counters(numEdgeIds);
+	for (auto& counter : counters) counter = 0;
+	std::function<void(const size_t&)> countFun = 
+	[&forEachEdge, &counters] (const size_t& chunkStart)
+	{
+		forEachEdge(chunkStart, [&counters](size_t edgeIdx, size_t)
+					{++counters[edgeIdx];});
+	};
+	processInParallel(alnChunks, countFun, 
+					  Parameters::get().numThreads, false);
+
+	_offsets.assign(numEdgeIds + 1, 0);
+	for (size_t i = 0; i < numEdgeIds; ++i)
+	{
+		_offsets[i + 1] = _offsets[i] + counters[i];
+		counters[i] = _offsets[i];
 	}
-	return alnIndex;
+	_alnIds.resize(_offsets.back());
+
+	std::function<void(const size_t&)> fillFun = 
+	[this, &forEachEdge, &counters] (const size_t& chunkStart)
+	{
+		forEachEdge(chunkStart, [this, &counters](size_t edgeIdx, size_t alnId)
+					{_alnIds[counters[edgeIdx]++] = alnId;});
+	};
+	processInParallel(alnChunks, fillFun, 
+					  Parameters::get().numThreads, false);
+
+	std::vector<size_t> edgeChunks;
+	for (size_t i = 0; i < numEdgeIds; i += CHUNK) edgeChunks.push_back(i);
+	std::function<void(const size_t&)> sortFun = 
+	[this, numEdgeIds, CHUNK] (const size_t& chunkStart)
+	{
+		size_t chunkEnd = std::min(chunkStart + CHUNK, numEdgeIds);
+		for (size_t edgeIdx = chunkStart; edgeIdx < chunkEnd; ++edgeIdx)
+		{
+			std::sort(_alnIds.begin() + _offsets[edgeIdx], 
+					  _alnIds.begin() + _offsets[edgeIdx + 1]);
+		}
+	};
+	processInParallel(edgeChunks, sortFun, 
+					  Parameters::get().numThreads, false);
 }
 
 float ReadAligner::getChainBaseDivergence(const GraphAlignment& chain, bool realign)
 {
-	static const float MAX_DIVERGENCE = Config::get("read_align_ovlp_divergence");
 	static const bool USE_HPC = (bool)Config::get("hpc_scoring_on");
 
 	float sumMatched = 0;
@@ -455,10 +610,14 @@ float ReadAligner::getChainBaseDivergence(const GraphAlignment& chain, bool real
 		float ovlpDivergence = aln.overlap.seqDivergence;
 		if (realign)
 		{
+			//exact divergence is needed for averaging over the chain,
+			//so no upper bound is given
 			ovlpDivergence = 
 				getAlignmentErrEdlib(aln.overlap, _readSeqs.getSeq(aln.overlap.curId), 
 									 _graph.edgeSequences().getSeq(aln.overlap.extId),
-									 MAX_DIVERGENCE, USE_HPC);
+									 /*max divergence*/ 1.0f, USE_HPC,
+									 _readSeqs.getHpcSeq(aln.overlap.curId),
+									 _graph.edgeSequences().getHpcSeq(aln.overlap.extId));
 		}
 
 		sumMatched += aln.overlap.curRange() * (1 - ovlpDivergence);
@@ -18,11 +18,73 @@ struct EdgeAlignment
 };
 typedef std::vector<EdgeAlignment> GraphAlignment;
 
+//Inverted index from the graph edges to the read alignments
+//(with more than one edge) that pass through them. Alignments are
+//referenced by their positions in the ReadAligner, instead of being
+//copied, and the references are stored in CSR arrays addressed by edge id
+class AlignmentIndex
+{
+public:
+	class Range
+	{
+	public:
+		class Iterator
+		{
+		public:
+			Iterator(const std::vector<GraphAlignment>* alignments,
+					 const uint32_t* pos):
+				_alignments(alignments), _pos(pos) {}
+			const GraphAlignment& operator*() const
+				{return (*_alignments)[*_pos];}
+			Iterator& operator++() {++_pos; return *this;}
+			bool operator!=(const Iterator& other) const
+				{return _pos != other._pos;}
+		private:
+			const std::vector<GraphAlignment>* _alignments;
+			const uint32_t* _pos;
+		};
+
+		Range(const std::vector<GraphAlignment>* alignments,
+			  const uint32_t* begin, const uint32_t* end):
+			_alignments(alignments), _begin(begin), _end(end) {}
+		Iterator begin() const {return Iterator(_alignments, _begin);}
+		Iterator end() const {return Iterator(_alignments, _end);}
+		size_t size() const {return _end - _begin;}
+		bool empty() const {return _begin == _end;}
+	private:
+		const std::vector<GraphAlignment>* _alignments;
+		const uint32_t* _begin;
+		const uint32_t* _end;
+	};
+
+	AlignmentIndex(): _alignments(nullptr) {}
+
+	//alignments of each edge are in the same order as in the input
+	void build(const std::vector<GraphAlignment>& alignments);
+	void clear();
+
+	Range operator[](const GraphEdge* edge) const
+	{
+		size_t edgeIdx = edge->edgeId.index();
+		if (edgeIdx + 1 >= _offsets.size()) 
+		{
+			return Range(_alignments, nullptr, nullptr);
+		}
+		return Range(_alignments, _alnIds.data() + _offsets[edgeIdx],
+					 _alnIds.data() + _offsets[edgeIdx + 1]);
+	}
+
+private:
+	const std::vector<GraphAlignment>* _alignments;
+	std::vector<size_t> _offsets;
+	std::vector<uint32_t> _alnIds;
+};
+
 class ReadAligner
 {
 public:
 	ReadAligner(RepeatGraph& graph, const SequenceContainer& readSeqs): 
-		_graph(graph), _readSeqs(readSeqs) {}
+		_alnIndexValid(false), _graph(graph), _readSeqs(readSeqs) {}
 
 	void alignReads();
 	void updateAlignments();
@@ -32,9 +94,9 @@ public:
 	void storeAlignments(const std::string& filename);
 	void loadAlignments(const std::string& filename);
 
-	typedef std::unordered_map<GraphEdge*, 
-					   		   std::vector<GraphAlignment>> AlnIndex;
-	AlnIndex makeAlignmentIndex();
+	//the index is persistent: it is only rebuilt if
+	//the alignments have changed since the last call
+	const AlignmentIndex& getAlignmentIndex() const;
 
 	typedef std::unordered_map<GraphEdge*, 
 							   std::unordered_map<GraphEdge*, int>> ConnIndex;
@@ -47,6 +109,8 @@ private:
 	float getChainBaseDivergence(const GraphAlignment& aln, bool realign);
 
 	std::vector<GraphAlignment> _readAlignments;
+	mutable AlignmentIndex _alnIndex;
+	mutable bool _alnIndexValid;
 
 	RepeatGraph& _graph;
 	//const SequenceContainer&   _asmSeqs;
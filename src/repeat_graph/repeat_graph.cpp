@@ -1346,6 +1346,12 @@ void RepeatGraph::updateEdgeSequences()
 		}*/
 	}
 	_edgeSeqsContainer->buildPositionIndex();
+	//compressed edges are reused by the base-level read alignment
+	if ((bool)Config::get("hpc_scoring_on") && 
+		(bool)Config::get("reads_base_alignment"))
+	{
+		_edgeSeqsContainer->buildHpcIndex();
+	}
 }
 
 RepeatGraph::~RepeatGraph()
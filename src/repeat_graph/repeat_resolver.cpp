@@ -170,7 +170,7 @@ int RepeatResolver::resolveConnections(const std::vector<Connection>& connection
 }
 
 bool RepeatResolver::checkForTandemCopies(const GraphEdge* checkEdge,
-										  const std::vector<GraphAlignment>& alignments)
+										  const AlignmentIndex::Range& alignments)
 {
 	const int NEEDED_READS = 5;
 	int readEvidence = 0;
@@ -188,7 +188,7 @@ bool RepeatResolver::checkForTandemCopies(const GraphEdge* checkEdge,
 }
 
 bool RepeatResolver::checkByReadExtension(const GraphEdge* checkEdge,
-										  const std::vector<GraphAlignment>& alignments)
+										  const AlignmentIndex::Range& alignments)
 {
 	std::unordered_map<GraphEdge*, std::vector<int>> outFlanks;
 	std::unordered_map<GraphEdge*, std::vector<int>> outSpans;
@@ -335,7 +335,7 @@ void RepeatResolver::findRepeats()
 {
 	Logger::get().debug() << "Finding repeats";
 
-	auto alnIndex = _aligner.makeAlignmentIndex();
+	const auto& alnIndex = _aligner.getAlignmentIndex();
 
 	//all edges are unique at the beginning
 	for (auto& edge : _graph.iterEdges())
@@ -803,7 +803,7 @@ int RepeatResolver::resolveSimpleRepeats()
 	static const int MIN_JCT_SUPPORT = 1;
 	static const int MAX_DEGREE = 5;
 
-	auto alnIndex = _aligner.makeAlignmentIndex();
+	const auto& alnIndex = _aligner.getAlignmentIndex();
 
 	GraphProcessor proc(_graph, _asmSeqs);
 	auto unbranchingPaths = proc.getUnbranchingPaths();
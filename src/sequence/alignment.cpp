@@ -3,7 +3,14 @@
 //Released under the BSD license (see LICENSE file)
 
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include <iomanip>
+#include <limits>
+#include <thread>
+#include <functional>
 
 #include "alignment.h"
 
@@ -20,8 +27,12 @@ namespace
 {
 	struct ThreadMemPool
 	{
+		//cleanup times of different threads are spread using the thread id
+		//(not rand(), which would change the global random sequence)
 		ThreadMemPool():
-			prevCleanup(system_clock::now() + seconds(rand() % 60))
+			prevCleanup(system_clock::now() + 
+						seconds(std::hash<std::thread::id>()
+								(std::this_thread::get_id()) % 60))
 		{
 		   memPool = km_init();
 		}
@@ -43,30 +54,321 @@ namespace
 		void* memPool;
 	};
 
-	struct CompressedSeq
+	//Homopolymer-compressed (if needed) sequence range. Takes a subrange of
+	//the precomputed compressed sequence if available, otherwise
+	//compresses on the fly and stores the offset table.
+	//The precomputed sequence is referenced rather than copied,
+	//since DnaSequence reference counters are not thread-safe
+	class CompressedRange
 	{
-		DnaSequence seq;
-		std::vector<int32_t> offsetTable;
+	public:
+		CompressedRange(const DnaSequence& seq, const HpcSequence* hpcSeq,
+						int32_t start, int32_t length, bool doCompression):
+			_hpcSeq(doCompression ? hpcSeq : nullptr), _seq(nullptr),
+			_begin(0), _length(0), _origStart(start)
+		{
+			if (_hpcSeq)
+			{
+				_seq = &_hpcSeq->compressed();
+				_begin = _hpcSeq->toCompressed(start);
+				_length = _hpcSeq->toCompressed(start + length - 1) - _begin + 1;
+				return;
+			}
+
+			std::vector<uint8_t> rawSeq(length);
+			seq.copyRaw(start, length, rawSeq.data());
+			std::string newSeq;
+			newSeq.reserve(length);
+			_offsetTable.reserve(length);
+			for (size_t i = 0; i < (size_t)length; ++i)
+			{
+				if (!doCompression || i == 0 || rawSeq[i] != rawSeq[i - 1])
+				{
+					newSeq += DnaSequence::idToDna(rawSeq[i]);
+					_offsetTable.push_back(i);
+				}
+			}
+			_ownSeq = DnaSequence(newSeq);
+			_seq = &_ownSeq;
+			_length = _ownSeq.length();
+		}
+		CompressedRange(const CompressedRange&) = delete;
+		CompressedRange& operator=(const CompressedRange&) = delete;
+
+		const DnaSequence& sequence() const {return *_seq;}
+		int32_t begin() const {return _begin;}
+		int32_t length() const {return _length;}
+
+		//offset of the compressed position within the range
+		//in the original coordinates
+		int32_t originalOffset(int32_t pos) const
+		{
+			if (!_hpcSeq) return _offsetTable[pos];
+			if (pos == 0) return 0;
+			return _hpcSeq->toOriginal(_begin + pos) - _origStart;
+		}
+
+	private:
+		const HpcSequence* _hpcSeq;
+		const DnaSequence* _seq;
+		DnaSequence _ownSeq;
+		std::vector<int32_t> _offsetTable;
+		int32_t _begin;
+		int32_t _length;
+		int32_t _origStart;
+	};
+
+	//2-bit nucleotide codes of the sequence range, optionally
+	//homopolymer-compressed
+	void rawRange(const DnaSequence& seq, const HpcSequence* hpcSeq,
+				  int32_t start, int32_t length, bool doCompression, 
+				  std::vector<char>& out)
+	{
+		if (doCompression && hpcSeq)
+		{
+			int32_t hpcBegin = hpcSeq->toCompressed(start);
+			int32_t hpcLen = hpcSeq->toCompressed(start + length - 1) - hpcBegin + 1;
+			out.resize(hpcLen);
+			hpcSeq->compressed().copyRaw(hpcBegin, hpcLen, 
+										 reinterpret_cast<uint8_t*>(out.data()));
+			return;
+		}
+
+		out.resize(length);
+		seq.copyRaw(start, length, reinterpret_cast<uint8_t*>(out.data()));
+		if (doCompression)
+		{
+			out.erase(std::unique(out.begin(), out.end()), out.end());
+		}
+	}
+
+	struct IntervalDiv
+	{
+		int start;
+		int end;
+		float divergence;
+		int realLen;
 	};
 
-	CompressedSeq homopolymerCompression(const DnaSequence& seq, int32_t start, int32_t length,
-										 bool doCompression)
+	//the order in which good intervals are selected:
+	//longest real length first, then longest in cigar, then leftmost
+	bool selectedBefore(const IntervalDiv& i1, const IntervalDiv& i2)
 	{
-		std::string newSeq;
-		newSeq.reserve(length);
-		std::vector<int32_t> offsetTable;
-		offsetTable.reserve(length);
+		if (i1.realLen != i2.realLen) return i1.realLen > i2.realLen;
+		if (i1.end - i1.start != i2.end - i2.start) 
+		{
+			return i1.end - i1.start > i2.end - i2.start;
+		}
+		return i1.start < i2.start;
+	}
 
-		for (size_t i = 0; i < (size_t)length; ++i)
+	//Min-tree over the prefix values P(k) = bound * sumLen[k] - sumErrors[k]
+	//at the match positions of the cigar (other positions can not start
+	//an interval). Finds the leftmost start i in [lo, hi] with P(i) < x
+	//(or P(i) <= x, if inclusive) in O(log n).
+	class PrefixMinTree
+	{
+	public:
+		PrefixMinTree(const std::vector<CigOp>& cigar, const std::vector<int>& sumLen,
+					  const std::vector<int>& sumErrors, double bound):
+			_size(1)
 		{
-			if (!doCompression || i == 0 || newSeq.back() != seq.at(i + start))
+			while (_size < (int)cigar.size()) _size *= 2;
+			_tree.assign(2 * _size, std::numeric_limits<double>::infinity());
+			for (size_t k = 0; k < cigar.size(); ++k)
 			{
-				newSeq += seq.at(i + start);
-				offsetTable.push_back(i);
+				//exact, since the values fit into the double mantissa
+				if (cigar[k].op == '=') 
+				{
+					_tree[_size + k] = bound * sumLen[k] - sumErrors[k];
+				}
 			}
-			
+			for (int node = _size - 1; node > 0; --node)
+			{
+				_tree[node] = std::min(_tree[2 * node], _tree[2 * node + 1]);
+			}
+		}
+
+		int leftmostBelow(int lo, int hi, double x, bool inclusive) const
+		{
+			if (lo > hi) return -1;
+			return this->descend(1, 0, _size - 1, lo, hi, x, inclusive);
+		}
+
+	private:
+		int descend(int node, int nodeLo, int nodeHi, int lo, int hi, 
+					double x, bool inclusive) const
+		{
+			if (nodeHi < lo || nodeLo > hi) return -1;
+			if (inclusive ? _tree[node] > x : _tree[node] >= x) return -1;
+			if (nodeLo == nodeHi) return nodeLo;
+
+			int mid = (nodeLo + nodeHi) / 2;
+			int left = this->descend(2 * node, nodeLo, mid, lo, hi, x, inclusive);
+			if (left != -1) return left;
+			return this->descend(2 * node + 1, mid + 1, nodeHi, lo, hi, x, inclusive);
+		}
+
+		int _size;
+		std::vector<double> _tree;
+	};
+
+	//Keeps the best interval ending at every cigar operation j
+	//(given by its start, or -1 if there is none). Each node stores 
+	//the best interval end in its subtree (in selectedBefore order) 
+	//and the minimum start.
+	class CandidateTree
+	{
+	public:
+		CandidateTree(const std::vector<int>& sumCurLen, 
+					  const std::vector<int>& sumExtLen, int numOps):
+			_sumCurLen(sumCurLen), _sumExtLen(sumExtLen), _size(1)
+		{
+			while (_size < numOps) _size *= 2;
+			_starts.assign(numOps, -1);
+			_bestEnd.assign(2 * _size, -1);
+			_minStart.assign(2 * _size, std::numeric_limits<int>::max());
 		}
-		return {DnaSequence(newSeq), offsetTable};
+
+		IntervalDiv candidate(int end) const
+		{
+			int start = _starts[end];
+			int realLen = std::max(_sumCurLen[end + 1] - _sumCurLen[start],
+								   _sumExtLen[end + 1] - _sumExtLen[start]);
+			return {start, end, 0.0f, realLen};
+		}
+
+		void setStart(int end, int start)
+		{
+			_starts[end] = start;
+			int node = _size + end;
+			_bestEnd[node] = start >= 0 ? end : -1;
+			_minStart[node] = start >= 0 ? start : std::numeric_limits<int>::max();
+			for (node /= 2; node > 0; node /= 2)
+			{
+				_bestEnd[node] = this->better(_bestEnd[2 * node], 
+											  _bestEnd[2 * node + 1]);
+				_minStart[node] = std::min(_minStart[2 * node], 
+										   _minStart[2 * node + 1]);
+			}
+		}
+
+		//end of the best interval overall, or -1
+		int bestEnd() const {return _bestEnd[1];}
+
+		//any interval end >= lo with the start <= maxStart, or -1
+		int findStartBelow(int lo, int maxStart) const
+		{
+			return this->descend(1, 0, _size - 1, lo, maxStart);
+		}
+
+	private:
+		int better(int end1, int end2) const
+		{
+			if (end1 == -1) return end2;
+			if (end2 == -1) return end1;
+			return selectedBefore(this->candidate(end1), 
+								  this->candidate(end2)) ? end1 : end2;
+		}
+
+		int descend(int node, int nodeLo, int nodeHi, int lo, int maxStart) const
+		{
+			if (nodeHi < lo || _minStart[node] > maxStart) return -1;
+			if (nodeLo == nodeHi) return nodeLo;
+
+			int mid = (nodeLo + nodeHi) / 2;
+			int left = this->descend(2 * node, nodeLo, mid, lo, maxStart);
+			if (left != -1) return left;
+			return this->descend(2 * node + 1, mid + 1, nodeHi, lo, maxStart);
+		}
+
+		const std::vector<int>& _sumCurLen;
+		const std::vector<int>& _sumExtLen;
+		int _size;
+		std::vector<int> _starts;
+		std::vector<int> _bestEnd;
+		std::vector<int> _minStart;
+	};
+
+	//Selects non-intersecting cigar intervals with divergence below maxDivergence
+	//(both ends are matches), greedily from the longest ones. This is the same as
+	//choosing the first interval (in selectedBefore order) within the whole cigar,
+	//and then recursing into the parts on its left and right.
+	//
+	//An interval is good if err < maxDiv * max(curLen, extLen), which holds
+	//iff err < maxDiv * curLen or err < maxDiv * extLen, or equivalently
+	//P(i) < P(j + 1) for P(k) = maxDiv * sumLen[k] - sumErrors[k] with either
+	//of the lengths. The first interval ending at j is the one with the 
+	//leftmost good start i, which is found with a range-min query over P.
+	//
+	//Instead of rescanning every part, the best interval ending at each j 
+	//is kept in a tree. After an interval [s, e] is selected, the ends
+	//inside it are removed, and only the ends right of it that had 
+	//their start within [s, e] (or before) are updated - ends on the left
+	//are not affected. Each selection and update takes O(log n).
+	std::vector<IntervalDiv> 
+		selectGoodIntervals(const std::vector<CigOp>& cigar,
+							const std::vector<int>& sumCurLen,
+							const std::vector<int>& sumExtLen,
+							const std::vector<int>& sumErrors,
+							float maxDivergence)
+	{
+		//float(err) / len < maxDivergence holds iff err < bound * len 
+		//in exact arithmetic, where the bound is the midpoint between maxDivergence 
+		//and the previous float. The midpoint itself is rounded down (and passes)
+		//only if maxDivergence has an odd mantissa (round half to even).
+		const double bound = ((double)std::nextafter(maxDivergence, 0.0f) + 
+							  (double)maxDivergence) / 2;
+		uint32_t divBits = 0;
+		memcpy(&divBits, &maxDivergence, sizeof(divBits));
+		const bool inclusive = maxDivergence > 0 && (divBits & 1);
+
+		const int numOps = cigar.size();
+		PrefixMinTree curTree(cigar, sumCurLen, sumErrors, bound);
+		PrefixMinTree extTree(cigar, sumExtLen, sumErrors, bound);
+
+		//leftmost good start within [rangeBegin, j] for the interval ending at j
+		auto goodStart = [&](int rangeBegin, int j)
+		{
+			if (cigar[j].op != '=') return -1;
+			int curStart = curTree.leftmostBelow(rangeBegin, j, 
+								bound * sumCurLen[j + 1] - sumErrors[j + 1], inclusive);
+			int extStart = extTree.leftmostBelow(rangeBegin, j, 
+								bound * sumExtLen[j + 1] - sumErrors[j + 1], inclusive);
+			if (curStart == -1) return extStart;
+			if (extStart == -1) return curStart;
+			return std::min(curStart, extStart);
+		};
+
+		CandidateTree candidates(sumCurLen, sumExtLen, numOps);
+		for (int j = 0; j < numOps; ++j)
+		{
+			candidates.setStart(j, goodStart(0, j));
+		}
+
+		std::vector<IntervalDiv> selected;
+		for (int end = candidates.bestEnd(); end != -1; end = candidates.bestEnd())
+		{
+			IntervalDiv best = candidates.candidate(end);
+			int rangeErr = sumErrors[best.end + 1] - sumErrors[best.start];
+			best.divergence = float(rangeErr) / best.realLen;
+			selected.push_back(best);
+
+			for (int j = best.start; j <= best.end; ++j)
+			{
+				candidates.setStart(j, -1);
+			}
+			//the remaining ends with starts <= best.end lie right of 
+			//the interval, within the same part of the cigar
+			for (int j = candidates.findStartBelow(best.end + 1, best.end); j != -1;
+				 j = candidates.findStartBelow(j, best.end))
+			{
+				candidates.setStart(j, goodStart(best.end + 1, j));
+			}
+		}
+
+		std::sort(selected.begin(), selected.end(), selectedBefore);
+		return selected;
 	}
 
 	/*void printAlignment(const std::string& alnQry, const std::string& alnTrg)
@@ -101,7 +403,8 @@ namespace
 
 float getAlignmentCigarKsw(const DnaSequence& trgSeq, size_t trgBegin, size_t trgLen,
 			   			   const DnaSequence& qrySeq, size_t qryBegin, size_t qryLen,
-			   			   float maxAlnErr, std::vector<CigOp>& cigarOut)
+			   			   float maxAlnErr, std::vector<CigOp>& cigarOut,
+						   int bandHint)
 {
 	int matchScore = 2;
 	int misScore = -4;
@@ -112,17 +415,10 @@ float getAlignmentCigarKsw(const DnaSequence& trgSeq, size_t trgBegin, size_t tr
 	thread_local std::vector<uint8_t> trgByte;
 	thread_local std::vector<uint8_t> qryByte;
 	buf.cleanIter();
-	trgByte.assign(trgLen, 0);
-	qryByte.assign(qryLen, 0);
-
-	for (size_t i = 0; i < trgLen; ++i)
-	{
-		trgByte[i] = trgSeq.atRaw(i + trgBegin);
-	}
-	for (size_t i = 0; i < qryLen; ++i)
-	{
-		qryByte[i] = qrySeq.atRaw(i + qryBegin);
-	}
+	trgByte.resize(trgLen);
+	qryByte.resize(qryLen);
+	trgSeq.copyRaw(trgBegin, trgLen, trgByte.data());
+	qrySeq.copyRaw(qryBegin, qryLen, qryByte.data());
 
 	//substitution matrix
 	int8_t a = matchScore;
@@ -143,9 +439,18 @@ float getAlignmentCigarKsw(const DnaSequence& trgSeq, size_t trgBegin, size_t tr
 	//int bandWidth = std::max(10.0f, maxAlnErr * std::max(trgLen, qryLen));
 	(void)maxAlnErr;
 
-	//dynamic band selection
+	//dynamic band selection. Without z-drop, ksw only drops if the band
+	//does not reach the end cell, so we start from the first band that covers
+	//the length difference (and the caller's estimate), and only double
+	//it if that was not enough
 	ksw_extz_t ez;
 	int bandWidth = 64;
+	int minBand = std::max(bandHint, std::abs((int)trgLen - (int)qryLen));
+	while (bandWidth < minBand &&
+		   bandWidth <= (int)std::max(qryByte.size(), trgByte.size()))
+	{
+		bandWidth *= 2;
+	}
 	for (;;)
 	{
 		memset(&ez, 0, sizeof(ksw_extz_t));
@@ -224,34 +529,47 @@ float getAlignmentCigarKsw(const DnaSequence& trgSeq, size_t trgBegin, size_t tr
 }
 
 float getAlignmentErrEdlib(const OverlapRange& ovlp, const DnaSequence& trgSeq,
-					  	   const DnaSequence& qrySeq, float maxAlnErr, bool useHpc)
+					  	   const DnaSequence& qrySeq, float maxAlnErr, bool useHpc,
+						   const HpcSequence* trgHpc, const HpcSequence* qryHpc)
 {
-	thread_local ThreadMemPool buf;
-	buf.cleanIter();
-
-	auto trgCompressed = homopolymerCompression(trgSeq, ovlp.curBegin, 
-												ovlp.curRange(), useHpc);
-	auto qryCompressed = homopolymerCompression(qrySeq, ovlp.extBegin, 
-												ovlp.extRange(), useHpc);
+	//edlib works with any alphabet, so we pass 2-bit nucleotide
+	//codes directly instead of converting sequences to strings
+	thread_local std::vector<char> trgRaw;
+	thread_local std::vector<char> qryRaw;
+	rawRange(trgSeq, trgHpc, ovlp.curBegin, ovlp.curRange(), useHpc, trgRaw);
+	rawRange(qrySeq, qryHpc, ovlp.extBegin, ovlp.extRange(), useHpc, qryRaw);
+
+	//divergence above maxAlnErr is not computed exactly, since
+	//such alignments are rejected anyway. Length difference is
+	//a lower bound for the edit distance.
+	const int maxLen = std::max(trgRaw.size(), qryRaw.size());
+	const int maxK = maxAlnErr < 1.0f ? std::ceil(maxAlnErr * maxLen) : maxLen;
+	if (std::abs((int)trgRaw.size() - (int)qryRaw.size()) > maxK)
+	{
+		return 1.0f;
+	}
 
-	(void)maxAlnErr;
-	//int bandWidth = std::max(10.0f, maxAlnErr * std::max(ovlp.curRange(), 
-	//													 ovlp.extRange()));
-	//letting edlib find k byt iterating over powers of 2. Seems like
-	//it is in fact a little faster, than having a hard upper limit.
-	auto edlibCfg = edlibNewAlignConfig(-1, EDLIB_MODE_NW, 
-										EDLIB_TASK_DISTANCE, nullptr, 0);
-	auto result = edlibAlign(&qryCompressed.seq.str().c_str()[0], qryCompressed.seq.length(),
-							 &trgCompressed.seq.str().c_str()[0], trgCompressed.seq.length(), 
-							 edlibCfg);
+	//iterating over powers of 2 (as edlib does by default) 
+	//seems to be faster than using the upper bound right away
+	const int MIN_K = 64;
+	int editDistance = -1;
+	for (int k = MIN_K; ; k *= 2)
+	{
+		int curK = std::min(k, maxK);
+		auto edlibCfg = edlibNewAlignConfig(curK, EDLIB_MODE_NW, 
+											EDLIB_TASK_DISTANCE, nullptr, 0);
+		auto result = edlibAlign(qryRaw.data(), qryRaw.size(), 
+								 trgRaw.data(), trgRaw.size(), edlibCfg);
+		editDistance = result.editDistance;
+		edlibFreeAlignResult(result);
+		if (editDistance >= 0 || curK == maxK) break;
+	}
 	//Logger::get().debug() << result.editDistance << " " << result.alignmentLength;
-	if (result.editDistance < 0)
+	if (editDistance < 0)
 	{
 		return 1.0f;
 	}
-	return (float)result.editDistance / std::max(qryCompressed.seq.length(), 
-												 trgCompressed.seq.length());
-	//return (float)result.editDistance / result.alignmentLength;
+	return (float)editDistance / maxLen;
 }
 
 
@@ -314,18 +632,21 @@ void decodeCigar(const std::vector<CigOp>& cigar,
 std::vector<OverlapRange> 
 	checkIdyAndTrim(OverlapRange& ovlp, const DnaSequence& curSeq,
 					const DnaSequence& extSeq, float maxDivergence,
-					int32_t minOverlap, bool useHpc)
+					int32_t minOverlap, bool useHpc,
+					const HpcSequence* curHpc, const HpcSequence* extHpc)
 {
 	//homopolymer-compressed, if needed
-	auto curCompressed = homopolymerCompression(curSeq, ovlp.curBegin, 
-												ovlp.curRange(), useHpc);
-	auto extCompressed = homopolymerCompression(extSeq, ovlp.extBegin, 
-												ovlp.extRange(), useHpc);
+	CompressedRange curCompressed(curSeq, curHpc, ovlp.curBegin, 
+								  ovlp.curRange(), useHpc);
+	CompressedRange extCompressed(extSeq, extHpc, ovlp.extBegin, 
+								  ovlp.extRange(), useHpc);
 
 	//recompute base alignment with cigar output
 	std::vector<CigOp> cigar;
-	float errRate = getAlignmentCigarKsw(curCompressed.seq, 0, curCompressed.seq.length(),
-							 			 extCompressed.seq, 0, extCompressed.seq.length(),
+	float errRate = getAlignmentCigarKsw(curCompressed.sequence(), curCompressed.begin(), 
+										 curCompressed.length(),
+							 			 extCompressed.sequence(), extCompressed.begin(),
+										 extCompressed.length(),
 							 			 maxDivergence, cigar);
 	(void)errRate;
 
@@ -361,60 +682,11 @@ std::vector<OverlapRange>
 		sumErrors.push_back(sumErrors.back() + errLen);
 	}
 
-	struct IntervalDiv
-	{
-		int start;
-		int end;
-		float divergence;
-		int realLen;
-	};
-	std::vector<IntervalDiv> goodIntervals;
-	//const float EPS = 0.0001;
-
-	for (int intLen = (int)cigar.size(); intLen > 0; --intLen)
-	{
-		for (int intStart = 0; 
-			intStart < (int)cigar.size() - intLen + 1; ++intStart)
-		{
-			int i = intStart;
-			int j = intStart + intLen - 1;
-			//only consider intervals that end on matches
-			if (cigar[i].op != '=' || cigar[j].op != '=') continue;
-
-			int rangeLen = std::max(sumCurLen[j + 1] - sumCurLen[i],
-									sumExtLen[j + 1] - sumExtLen[i]);
-			int rangeErr = sumErrors[j + 1] - sumErrors[i];
-			float divergence = float(rangeErr) / rangeLen;
-
-			if (divergence < maxDivergence)
-			{
-				if (j - i >= 0) goodIntervals.push_back({i, j, divergence, rangeLen});
-			}
-		}
-	}
-
-	//sort intervals by acual length (not cigar length).
-	std::sort(goodIntervals.begin(), goodIntervals.end(),
-			  [](const IntervalDiv& i1, const IntervalDiv& i2)
-			  {return i1.realLen > i2.realLen;});
-	
-	//greedily select non-intersecting set
-	std::vector<IntervalDiv> nonIntersecting;
-	for (auto& interval : goodIntervals)
-	{
-		bool intersects = false;
-		for (auto& otherInt : nonIntersecting)
-		{
-			int ovl = std::min(interval.end + 1, otherInt.end + 1) - 
-					  std::max(interval.start, otherInt.start);
-			if (ovl > 0) 
-			{
-				intersects = true;
-				break;
-			}
-		}
-		if (!intersects) nonIntersecting.push_back(interval);
-	}
+	//greedily select non-intersecting intervals with low divergence,
+	//starting from the longest ones
+	std::vector<IntervalDiv> nonIntersecting = 
+		selectGoodIntervals(cigar, sumCurLen, sumExtLen, sumErrors, 
+							maxDivergence);
 
 	//to preven bad alignment ends, select the best local alignment
 	//within the interval
@@ -449,43 +721,21 @@ std::vector<OverlapRange>
 	}
 
 	//now, for each interesting interval check its length and create new overlaps
-	//also need to transofrm back from HPC to original coordinates
+	//also need to transofrm back from HPC to original coordinates.
+	//Interval bounds in the compressed sequences are given by the prefix sums
 	std::vector<OverlapRange> trimmedAlignments;
 	for (auto intCand : nonIntersecting)
 	{
 		OverlapRange newOvlp = ovlp;
 		newOvlp.seqDivergence = intCand.divergence;
-		size_t posQry = 0;
-		size_t posTrg = 0;
-		for (int i = 0; i < (int)cigar.size(); ++i)
-		{
-			if (i == intCand.start)
-			{
-				newOvlp.curBegin += curCompressed.offsetTable[posTrg];
-				newOvlp.extBegin += extCompressed.offsetTable[posQry];
-			}
-
-			if (cigar[i].op == '=' || cigar[i].op == 'X')
-			{
-				posQry += cigar[i].len;
-				posTrg += cigar[i].len;
-			}
-			else if (cigar[i].op == 'I')
-			{
-				posQry += cigar[i].len;
-			}
-			else
-			{
-				posTrg += cigar[i].len;
-			}
-
-			if (i == intCand.end)
-			{
-				newOvlp.curEnd = ovlp.curBegin + curCompressed.offsetTable[posTrg - 1];
-				newOvlp.extEnd = ovlp.extBegin + extCompressed.offsetTable[posQry - 1];
-			}
-
-		}
+		newOvlp.curBegin = ovlp.curBegin + 
+			curCompressed.originalOffset(sumCurLen[intCand.start]);
+		newOvlp.extBegin = ovlp.extBegin + 
+			extCompressed.originalOffset(sumExtLen[intCand.start]);
+		newOvlp.curEnd = ovlp.curBegin + 
+			curCompressed.originalOffset(sumCurLen[intCand.end + 1] - 1);
+		newOvlp.extEnd = ovlp.extBegin + 
+			extCompressed.originalOffset(sumExtLen[intCand.end + 1] - 1);
 		//TODO: updating score and k-mer matches?
 		
 		if (newOvlp.curRange() > minOverlap &&
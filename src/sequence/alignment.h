@@ -16,12 +16,16 @@ float getAlignmentErrEdlib(const OverlapRange& ovlp,
 					  	   const DnaSequence& trgSeq,
 					  	   const DnaSequence& qrySeq,
 						   float maxAlnErr,
-						   bool useHpc);
+						   bool useHpc,
+						   const HpcSequence* trgHpc = nullptr,
+						   const HpcSequence* qryHpc = nullptr);
 
 std::vector<OverlapRange> 
 	checkIdyAndTrim(OverlapRange& ovlp, const DnaSequence& curSeq,
 					const DnaSequence& extSeq, float maxDivergence,
-					int32_t minOverlap, bool useHpc);
+					int32_t minOverlap, bool useHpc,
+					const HpcSequence* curHpc = nullptr,
+					const HpcSequence* extHpc = nullptr);
 
 struct CigOp
 {
@@ -31,7 +35,8 @@ struct CigOp
 
 float getAlignmentCigarKsw(const DnaSequence& trgSeq, size_t trgBegin, size_t trgLen,
 			   			   const DnaSequence& qrySeq, size_t qryBegin, size_t qryLen,
-			   			   float maxAlnErr, std::vector<CigOp>& cigarOut);
+			   			   float maxAlnErr, std::vector<CigOp>& cigarOut,
+						   int bandHint = 0);
 
 void decodeCigar(const std::vector<CigOp>& cigar, const DnaSequence& trgSeq, size_t trgBegin,
 				 const DnaSequence& qrySeq, size_t qryBegin,
@@ -3,6 +3,7 @@
 //Released under the BSD license (see LICENSE file)
 
 #include <cassert>
+#include <cstdlib>
 #include <algorithm>
 #include <fstream>
 
@@ -15,36 +16,95 @@
 #include "../common/matrix.h"
 
 
-std::vector<FastaRecord> 
-	ConsensusGenerator::generateConsensuses(const std::vector<ContigPath>& contigs, 
-											bool verbose)
+//Generates consensuses batch by batch, writing each batch to the
+//output file as soon as it is ready and releasing the corresponding 
+//paths, so that consensus sequences of all contigs are never 
+//held in memory at once. The output order is the same as the input.
+void ConsensusGenerator::streamConsensuses(std::vector<ContigPath>& contigs,
+										   const std::string& outFasta,
+										   bool verbose)
 {
+	//enough alignment tasks per batch to keep all threads busy
+	const size_t MIN_BATCH_TASKS = 64 * Parameters::get().numThreads;
+
 	if (verbose) Logger::get().info() << "Generating sequence";
-	std::vector<std::vector<AlignmentInfo>> allAlignments;
-	std::vector<FastaRecord> consensuses;
+	FILE* fout = fopen(outFasta.c_str(), "w");
+	if (!fout) throw std::runtime_error("Can't open " + outFasta);
+
+	ProgressPercent progress(contigs.size());
+	if (verbose) progress.advance(0);
+
+	size_t batchBegin = 0;
+	while (batchBegin < contigs.size())
+	{
+		size_t batchEnd = batchBegin;
+		size_t batchTasks = 0;
+		while (batchEnd < contigs.size() && batchTasks < MIN_BATCH_TASKS)
+		{
+			batchTasks += contigs[batchEnd].overlaps.size() + 1;
+			++batchEnd;
+		}
+
+		auto batchRecords = this->generateBatch(contigs, batchBegin, 
+												batchEnd, false);
+		SequenceContainer::writeFasta(batchRecords, fout);
+		fflush(fout);
+
+		for (size_t i = batchBegin; i < batchEnd; ++i)
+		{
+			contigs[i] = ContigPath();
+		}
+		if (verbose) progress.advance(batchEnd - batchBegin);
+		batchBegin = batchEnd;
+	}
+	fclose(fout);
+}
+
+//generates consensuses for the contigs in [begin, end) range
+std::vector<FastaRecord> 
+	ConsensusGenerator::generateBatch(const std::vector<ContigPath>& contigs, 
+									  size_t begin, size_t end, bool verbose)
+{
+	auto alignments = this->generateAlignments(contigs, begin, end, verbose);
 
-	auto alnMap = this->generateAlignments(contigs, verbose);
 	//then, generate contig sequences
-	for (size_t i = 0; i < contigs.size(); ++i)
+	std::vector<FastaRecord> consensuses(end - begin);
+	std::vector<size_t> tasks;
+	for (size_t i = begin; i < end; ++i)
 	{
-		if (contigs[i].sequences.empty()) continue;
 		if (contigs[i].sequences.size() == 1)
 		{
-			FastaRecord rec(contigs[i].sequences.front(), contigs[i].name, 
-							FastaRecord::ID_NONE);
-			consensuses.push_back(rec);
+			consensuses[i - begin] = FastaRecord(contigs[i].sequences.front(), 
+												 contigs[i].name, 
+												 FastaRecord::ID_NONE);
 		}
-		else
+		else if (contigs[i].sequences.size() > 1)
 		{
-			consensuses.push_back(this->generateLinear(contigs[i], alnMap));
+			tasks.push_back(i);
 		}
 	}
-	return consensuses;
+	std::function<void(const size_t&)> linearFunc =
+	[this, &contigs, &alignments, &consensuses, begin](const size_t& contigId)
+	{
+		consensuses[contigId - begin] = 
+			this->generateLinear(contigs[contigId], alignments[contigId - begin]);
+	};
+	processInParallel(tasks, linearFunc, Parameters::get().numThreads, false);
+
+	std::vector<FastaRecord> nonEmpty;
+	for (size_t i = begin; i < end; ++i)
+	{
+		if (!contigs[i].sequences.empty())
+		{
+			nonEmpty.push_back(std::move(consensuses[i - begin]));
+		}
+	}
+	return nonEmpty;
 }
 
 
 FastaRecord ConsensusGenerator::generateLinear(const ContigPath& path, 
-											   const AlignmentsMap& alnMap)
+											   const PathAlignments& alignments)
 {
 	std::vector<FastaRecord> contigParts;
 
@@ -60,8 +120,7 @@ FastaRecord ConsensusGenerator::generateLinear(const ContigPath& path,
 		if (i != path.sequences.size() - 1)
 		{
 			auto curSwitch = 
-				this->getSwitchPositions(alnMap.at(&path.overlaps[i]),
-										 prevSwitch.second);
+				this->getSwitchPositions(alignments[i], prevSwitch.second);
 			rightCut = curSwitch.first;
 			prevSwitch = curSwitch;
 		}
@@ -83,51 +142,67 @@ FastaRecord ConsensusGenerator::generateLinear(const ContigPath& path,
 }
 
 
-ConsensusGenerator::AlignmentsMap 
+namespace
+{
+	//maximum deviation of the k-mer matches chain from the
+	//diagonal of the overlap start, if the matches were stored
+	int32_t kmerDiagonalSpread(const OverlapRange& ovlp)
+	{
+		if (!ovlp.kmerMatches) return 0;
+
+		int32_t maxSpread = 0;
+		for (auto& match : *ovlp.kmerMatches)
+		{
+			if (match.first < ovlp.curBegin || match.first > ovlp.curEnd) continue;
+			int32_t diag = (match.first - ovlp.curBegin) - 
+						   (match.second - ovlp.extBegin);
+			maxSpread = std::max(maxSpread, std::abs(diag));
+		}
+		return maxSpread;
+	}
+}
+
+std::vector<ConsensusGenerator::PathAlignments> 
 	ConsensusGenerator::generateAlignments(const std::vector<ContigPath>& contigs,
-										   bool verbose)
+										   size_t begin, size_t end, bool verbose)
 {
-	//typedef std::pair<const ContigPath*, size_t> AlnTask;
 	struct AlnTask
 	{
 		const ContigPath* path;
-		size_t contigId;
+		size_t ovlpId;
 		OverlapRange adjustedOverlap;
+		AlignmentInfo* outAlignment;
 	};
 
-	AlignmentsMap alnMap;
-	std::mutex mapMutex;
+	//each task writes into its own preallocated slot, so no locking is needed
+	std::vector<PathAlignments> alignments(end - begin);
+	for (size_t i = begin; i < end; ++i)
+	{
+		alignments[i - begin].resize(contigs[i].overlaps.size());
+	}
+
 	std::function<void(const AlnTask&)> alnFunc =
-	[&alnMap, &mapMutex](const AlnTask& task)
+	[](const AlnTask& task)
 	{
 		const ContigPath* path = task.path;
-		size_t i = task.contigId;
-		auto curOverlap = task.adjustedOverlap;
+		size_t i = task.ovlpId;
+		const auto& curOverlap = task.adjustedOverlap;
 
-		std::vector<CigOp> cigar;
 		const float maxErr = 0.3;
-		std::string alignedLeft;
-		std::string alignedRight;
+		AlignmentInfo& aln = *task.outAlignment;
 		getAlignmentCigarKsw(path->sequences[i], curOverlap.curBegin, curOverlap.curRange(),
 			   			     path->sequences[i + 1], curOverlap.extBegin, curOverlap.extRange(),
-			   			   	 maxErr, cigar);
-		decodeCigar(cigar, path->sequences[i], curOverlap.curBegin,
-				 	path->sequences[i + 1], curOverlap.extBegin,
-				 	alignedLeft, alignedRight);
-
-		{
-			std::lock_guard<std::mutex> lock(mapMutex);
-			alnMap[&path->overlaps[i]] = {alignedLeft, alignedRight, 
-						 				  curOverlap.curBegin, 
-										  curOverlap.extBegin};
-		}
+			   			   	 maxErr, aln.cigar, kmerDiagonalSpread(curOverlap));
+		aln.startOne = curOverlap.curBegin;
+		aln.startTwo = curOverlap.extBegin;
 	};
 
 	std::vector<AlnTask> tasks;
-	for (auto& path : contigs)
+	for (size_t pathId = begin; pathId < end; ++pathId)
 	{
+		auto& path = contigs[pathId];
 		int32_t prevSwitch = 0;
-		for (size_t i = 0; i < path.sequences.size() - 1; ++i)
+		for (size_t i = 0; i < path.overlaps.size(); ++i)
 		{
 			OverlapRange curOverlap = path.overlaps[i];
 
@@ -153,12 +228,13 @@ ConsensusGenerator::AlignmentsMap
 				curOverlap.extEnd -= endShift;
 			}
 
-			tasks.push_back({&path, i, curOverlap});
+			tasks.push_back({&path, i, curOverlap, 
+							 &alignments[pathId - begin][i]});
 		}
 	}
 	processInParallel(tasks, alnFunc, Parameters::get().numThreads, verbose);
 
-	return alnMap;
+	return alignments;
 }
 
 
@@ -172,23 +248,26 @@ ConsensusGenerator::getSwitchPositions(const AlignmentInfo& aln,
 	int leftPos = aln.startOne;
 	int rightPos = aln.startTwo;
 	int matchRun = 0;
-	for (size_t i = 0; i < aln.alnOne.length(); ++i)
+	for (auto& op : aln.cigar)
 	{
-		if (aln.alnOne[i] != '-') ++leftPos;
-		if (aln.alnTwo[i] != '-') ++rightPos;
-
-		if (aln.alnOne[i] != '-' && aln.alnTwo[i] != '-' &&
-			leftPos > prevSwitch + MIN_SEGMENT)
-		{
-			++matchRun;
-		}
-		else
+		bool alignedOp = (op.op == '=' || op.op == 'X');
+		for (int i = 0; i < op.len; ++i)
 		{
-			matchRun = 0;
-		}
-		if (matchRun == MIN_MATCH)
-		{
-			return {leftPos, rightPos};
+			if (op.op != 'I') ++leftPos;
+			if (op.op != 'D') ++rightPos;
+
+			if (alignedOp && leftPos > prevSwitch + MIN_SEGMENT)
+			{
+				++matchRun;
+			}
+			else
+			{
+				matchRun = 0;
+			}
+			if (matchRun == MIN_MATCH)
+			{
+				return {leftPos, rightPos};
+			}
 		}
 	}
 
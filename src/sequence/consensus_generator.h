@@ -10,6 +10,7 @@
 #include <vector>
 
 #include "../sequence/overlap.h"
+#include "../sequence/alignment.h"
 
 
 struct ContigPath
@@ -26,26 +27,29 @@ struct ContigPath
 class ConsensusGenerator
 {
 public:
-	std::vector<FastaRecord> 
-		generateConsensuses(const std::vector<ContigPath>& contigs, 
-							bool verbose = true);
+	void streamConsensuses(std::vector<ContigPath>& contigs,
+						   const std::string& outFasta,
+						   bool verbose = true);
 	
 private:
 	struct AlignmentInfo
 	{
-		std::string alnOne;
-		std::string alnTwo;
+		std::vector<CigOp> cigar;
 
 		int32_t startOne;
 		int32_t startTwo;
 	};
-	typedef std::unordered_map<const OverlapRange*, 
-							   AlignmentInfo> AlignmentsMap;
+	//alignments of the adjacent sequences of a path, one per overlap
+	typedef std::vector<AlignmentInfo> PathAlignments;
 
+	std::vector<FastaRecord> 
+		generateBatch(const std::vector<ContigPath>& contigs, 
+					  size_t begin, size_t end, bool verbose);
 	FastaRecord generateLinear(const ContigPath& path, 
-							   const AlignmentsMap& alnMap);
-	AlignmentsMap generateAlignments(const std::vector<ContigPath>& contigs, 
-									 bool verbose);
+							   const PathAlignments& alignments);
+	std::vector<PathAlignments> 
+		generateAlignments(const std::vector<ContigPath>& contigs, 
+						   size_t begin, size_t end, bool verbose);
 	std::pair<int32_t, int32_t> getSwitchPositions(const AlignmentInfo& aln,
 												   int32_t prevSwitch);
 };
@@ -13,14 +13,35 @@
 
 static_assert(sizeof(size_t) == 8, "32-bit architectures are not supported");
 
-class Kmer
+//K-mers are packed two bits per nucleotide into a single integer word.
+//The regular 64-bit k-mers support k <= 32, and the 128-bit ones are used
+//for the longer k-mers. The k-mer processing (counting, indexing and
+//seeding) is instantiated for both widths, and the width is selected
+//at runtime from Parameters::kmerSize (see VertexIndex)
+inline size_t hashKmerRepr(uint64_t x)
+{
+	size_t z = (x += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+inline size_t hashKmerRepr(unsigned __int128 x)
+{
+	return hashKmerRepr((uint64_t)x ^ hashKmerRepr((uint64_t)(x >> 64)));
+}
+
+template <class Repr>
+class BasicKmer
 {
 public:
-	typedef size_t KmerRepr;
+	typedef Repr KmerRepr;
 
-	explicit Kmer(KmerRepr repr=0): _representation(repr) {}
+	static const size_t MAX_SIZE = sizeof(KmerRepr) * 4;
 
-	Kmer(const DnaSequence& dnaString, 
+	explicit BasicKmer(KmerRepr repr=0): _representation(repr) {}
+
+	BasicKmer(const DnaSequence& dnaString, 
 		   size_t start, size_t length):
 		_representation(0)
 	{
@@ -36,10 +57,10 @@ public:
 		}
 	}
 
-	Kmer reverseComplement()
+	BasicKmer reverseComplement()
 	{
 		KmerRepr tmpRepr = _representation;
-		Kmer newKmer;
+		BasicKmer newKmer;
 
 		for (unsigned int i = 0; i < Parameters::get().kmerSize; ++i)
 		{
@@ -53,7 +74,7 @@ public:
 
 	bool standardForm()
 	{
-		Kmer complKmer = this->reverseComplement();
+		BasicKmer complKmer = this->reverseComplement();
 		if (complKmer._representation < _representation)
 		{
 			_representation = complKmer._representation;
@@ -67,8 +88,9 @@ public:
 		_representation <<= 2;
 		_representation += dnaSymbol;
 
-		KmerRepr kmerSize = Parameters::get().kmerSize;
-		KmerRepr kmerMask = ((KmerRepr)1 << kmerSize * 2) - 1;
+		size_t kmerSize = Parameters::get().kmerSize;
+		KmerRepr kmerMask = kmerSize < MAX_SIZE ? 
+			((KmerRepr)1 << kmerSize * 2) - 1 : ~(KmerRepr)0;
 		_representation &= kmerMask;
 	}
 
@@ -76,58 +98,64 @@ public:
 	{
 		_representation >>= 2;
 
-		KmerRepr kmerSize = Parameters::get().kmerSize;
-		KmerRepr shift = kmerSize * 2 - 2;
-		_representation += dnaSymbol << shift;
+		size_t kmerSize = Parameters::get().kmerSize;
+		size_t shift = kmerSize * 2 - 2;
+		_representation += (KmerRepr)dnaSymbol << shift;
 	}
 
 
-	bool operator == (const Kmer& other) const
+	bool operator == (const BasicKmer& other) const
 		{return this->_representation == other._representation;}
 
-	bool operator != (const Kmer& other) const
+	bool operator != (const BasicKmer& other) const
 		{return !(*this == other);}
 
 	size_t hash() const
 	{
-		size_t x = _representation;
-		size_t z = (x += 0x9E3779B97F4A7C15ULL);
-		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
-		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
-		return z ^ (z >> 31);
+		return hashKmerRepr(_representation);
 	}
 
-	bool operator< (const Kmer& other)
+	bool operator< (const BasicKmer& other)
 	{
 		return _representation < other._representation;
 	}
 
-	size_t numRepr() {return _representation;}
+	KmerRepr numRepr() {return _representation;}
 
 private:
 	KmerRepr _representation;
 };
 
+template <class Repr>
+const size_t BasicKmer<Repr>::MAX_SIZE;
+
+typedef BasicKmer<uint64_t> Kmer;
+typedef BasicKmer<unsigned __int128> LongKmer;
+
 namespace std
 {
-	template <>
-	struct hash<Kmer>
+	template <class Repr>
+	struct hash<BasicKmer<Repr>>
 	{
-		std::size_t operator()(const Kmer& kmer) const
+		std::size_t operator()(const BasicKmer<Repr>& kmer) const
 		{
 			return kmer.hash();
 		}
 	};
 }
 
-struct KmerPosition
+template <class KmerT>
+struct BasicKmerPosition
 {
-	KmerPosition(Kmer kmer, int32_t position):
+	BasicKmerPosition(KmerT kmer, int32_t position):
 		kmer(kmer), position(position) {}
-	Kmer kmer;
+	KmerT kmer;
 	int32_t position;
 };
 
+typedef BasicKmerPosition<Kmer> KmerPosition;
+
+template <class KmerT>
 class KmerIterator
 {
 public:
@@ -140,7 +168,7 @@ public:
 		if (position != readSeq->length() - Parameters::get().kmerSize)
 		{
 			//_kmer = Kmer(readSeq->substr(0, Parameters::get().kmerSize));
-			_kmer = Kmer(*readSeq, 0, Parameters::get().kmerSize);
+			_kmer = KmerT(*readSeq, 0, Parameters::get().kmerSize);
 		}
 	}
 
@@ -154,9 +182,9 @@ public:
 		return !(*this == other);
 	}
 
-	KmerPosition operator*() const
+	BasicKmerPosition<KmerT> operator*() const
 	{
-		return KmerPosition(_kmer, _position);
+		return BasicKmerPosition<KmerT>(_kmer, _position);
 	}
 
 	KmerIterator& operator++()
@@ -170,31 +198,32 @@ public:
 protected:
 	const DnaSequence* _readSeq;
 	size_t 	_position;
-	Kmer 	_kmer;
+	KmerT 	_kmer;
 };
 
 
-class IterKmers
+template <class KmerT>
+class BasicIterKmers
 {
 public:
-	IterKmers(const DnaSequence& sequence, size_t start = 0,
+	BasicIterKmers(const DnaSequence& sequence, size_t start = 0,
 			  size_t length = std::string::npos):
 		_sequence(sequence), _start(start), _length(length)
 	{}
 
-	KmerIterator begin()
+	KmerIterator<KmerT> begin()
 	{
 		if (_sequence.length() < Parameters::get().kmerSize + _start)
 			return this->end();
 
-		return KmerIterator(&_sequence, _start);
+		return KmerIterator<KmerT>(&_sequence, _start);
 	}
 
-	KmerIterator end()
+	KmerIterator<KmerT> end()
 	{
 		size_t end = _length == std::string::npos ?
 						_sequence.length() : _length + _start;
-		return KmerIterator(&_sequence, end - Parameters::get().kmerSize);
+		return KmerIterator<KmerT>(&_sequence, end - Parameters::get().kmerSize);
 	}
 
 private:
@@ -203,32 +232,36 @@ private:
 	const size_t _length;
 };
 
-inline std::vector<KmerPosition> yieldMinimizers(const DnaSequence& sequence, int window)
+typedef BasicIterKmers<Kmer> IterKmers;
+
+template <class KmerT = Kmer>
+std::vector<BasicKmerPosition<KmerT>> 
+	yieldMinimizers(const DnaSequence& sequence, int window)
 {
 	if (window < 1) throw std::runtime_error("wrong minimizer length");
 
 	struct KmerAndHash
 	{
-		KmerPosition kp;
+		BasicKmerPosition<KmerT> kp;
 		size_t hash;
 	};
 	thread_local std::deque<KmerAndHash> miniQueue;
 	miniQueue.clear();
 
-	std::vector<KmerPosition> minimizers;
+	std::vector<BasicKmerPosition<KmerT>> minimizers;
 	const size_t expectedSize = sequence.length() / window * 2;
 	minimizers.reserve(1.5 * expectedSize);
 
 	if (window == 1)
 	{
-		for (auto kmerPos : IterKmers(sequence))
+		for (auto kmerPos : BasicIterKmers<KmerT>(sequence))
 		{
 			minimizers.push_back(kmerPos);
 		}
 		return minimizers;
 	}
 
-	for (auto kmerPos : IterKmers(sequence))
+	for (auto kmerPos : BasicIterKmers<KmerT>(sequence))
 	{
 		auto stdKmer = kmerPos.kmer;
 		stdKmer.standardForm();
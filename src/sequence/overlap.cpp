@@ -15,6 +15,7 @@
 #include <cstring>
 #include <iomanip>
 #include <numeric>
+#include <random>
 
 #include "overlap.h"
 #include "alignment.h"
@@ -23,6 +24,8 @@
 #include "../common/parallel.h"
 #include "../common/disjoint_set.h"
 #include "../common/bfcontainer.h"
+#include "../common/memory_budget.h"
+#include "../common/profiler.h"
 
 
 //Check if it is a proper overlap
@@ -92,6 +95,61 @@ namespace
 		vec = std::vector<T>();
 		vec.reserve(newCapacity);
 	}
+
+	//k-mers are looked up in batches, and the positions of the whole
+	//batch are decoded together, so the memory accesses of
+	//the neighbouring k-mers are overlapped. Instantiated for
+	//each k-mer width of the index
+	template <class KmerT>
+	void collectKmerMatches(const BasicVertexIndex<KmerT>& vertexIndex,
+							const FastaRecord& fastaRec,
+							std::vector<int32_t>& curFilteredPos,
+							BFContainer<KmerMatch>& vecMatches)
+	{
+		typedef BasicVertexIndex<KmerT> IndexT;
+		const size_t LOOKUP_BATCH = 32;
+		thread_local std::vector<BasicKmerPosition<KmerT>> kmerBatch;
+		thread_local std::vector<typename IndexT::KmerLookup> kmerLookups;
+		thread_local std::vector<typename IndexT::ReadPosition> extPositions;
+		auto processBatch = [&]()
+		{
+			vertexIndex.lookupKmers(kmerBatch, kmerLookups);
+			for (const auto& kmerLookup : kmerLookups)
+			{
+				kmerLookup.positions.prefetchPositions();
+			}
+			for (size_t i = 0; i < kmerBatch.size(); ++i)
+			{
+				const auto& curKmerPos = kmerBatch[i];
+				if (kmerLookups[i].repetitive)
+				{
+					curFilteredPos.push_back(curKmerPos.position);
+					continue;
+				}
+
+				extPositions.clear();
+				kmerLookups[i].positions.decodePositions(extPositions);
+				for (const auto& extReadPos : extPositions)
+				{
+					//no trivial matches
+					if ((extReadPos.readId == fastaRec.id &&
+						extReadPos.position == curKmerPos.position)) continue;
+
+					vecMatches.emplace_back(curKmerPos.position, 
+											extReadPos.position,
+											extReadPos.readId);
+				}
+			}
+			kmerBatch.clear();
+		};
+		kmerBatch.clear();
+		for (const auto& curKmerPos : BasicIterKmers<KmerT>(fastaRec.sequence))
+		{
+			kmerBatch.push_back(curKmerPos);
+			if (kmerBatch.size() == LOOKUP_BATCH) processBatch();
+		}
+		processBatch();
+	}
 }
 
 //This implementation was inspired by Heng Li's minimap2 paper
@@ -100,7 +158,8 @@ std::vector<OverlapRange>
 OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec, 
 								bool forceLocal,
 								OvlpDivStats& divStats,
-								int maxOverlaps) const
+								int maxOverlaps,
+								const HpcSequence* fastaHpc) const
 {
 	//static std::ofstream fout("../kmers.txt");
 	
@@ -126,37 +185,15 @@ OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec,
 	BFContainer<KmerMatch> vecMatches(sharedChunkPool);
 
 	//speed benchmarks
-	thread_local float timeMemory = 0;
-	thread_local float timeKmerIndexFirst = 0;
-	thread_local float timeKmerIndexSecond = 0;
-	thread_local float timeDp = 0;
-	auto timeStart = std::chrono::system_clock::now();
-
-	/*static std::mutex reportMutex;
-	thread_local int threadId = rand() % 1000; 
-	thread_local int numTicks = 0;
-	++numTicks;
-	thread_local auto prevReport = std::chrono::system_clock::now();
-	if ((std::chrono::system_clock::now() - prevReport) > 
-		std::chrono::seconds(60))
-	{
-		std::lock_guard<std::mutex> lock(reportMutex);
-		prevReport = std::chrono::system_clock::now();
-		Logger::get().debug() << ">Perf " << threadId
-			<< " mem:" << timeMemory
-			<< " kmFst:" << timeKmerIndexFirst 
-			<< " kmSnd:" << timeKmerIndexSecond 
-			<< " dp:" << timeDp << " ticks: " << numTicks; 
-		Logger::get().debug() << ">Mem  " << threadId 
-			<< " chunks:" << sharedChunkPool.numberChunks();
-
-		timeMemory = 0;
-		timeKmerIndexFirst = 0;
-		timeKmerIndexSecond = 0;
-		timeDp = 0;
-		numTicks = 0;
-	}*/
-	timeStart = std::chrono::system_clock::now();
+	auto timeStart = std::chrono::steady_clock::now();
+	auto countTime = [&timeStart](const char* counterName)
+	{
+		auto timeNow = std::chrono::steady_clock::now();
+		Profiler::count(counterName, std::chrono::duration_cast
+							<std::chrono::microseconds>(timeNow - timeStart).count());
+		timeStart = timeNow;
+	};
+	Profiler::count("ovlp_queries");
 
 	//although once in a while shrink allocated memory size
 	//thread_local auto prevCleanup = 
@@ -169,43 +206,27 @@ OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec,
 		shrinkAndClear(scoreTable, 2);
 		shrinkAndClear(backtrackTable, 2);
 	}
-	timeMemory += std::chrono::duration_cast<std::chrono::duration<float>>
-						(std::chrono::system_clock::now() - timeStart).count();
-	timeStart = std::chrono::system_clock::now();
+	countTime("ovlp_memory_us");
 
-	for (const auto& curKmerPos : IterKmers(fastaRec.sequence))
+	if (!_vertexIndex.longKmers())
 	{
-		if (_vertexIndex.isRepetitive(curKmerPos.kmer))
-		{
-			curFilteredPos.push_back(curKmerPos.position);
-			continue;
-		}
-		if (!_vertexIndex.kmerFreq(curKmerPos.kmer)) continue;
-
-		//FastaRecord::Id prevSeqId = FastaRecord::ID_NONE;
-		for (const auto& extReadPos : _vertexIndex.iterKmerPos(curKmerPos.kmer))
-		{
-			//no trivial matches
-			if ((extReadPos.readId == fastaRec.id &&
-				extReadPos.position == curKmerPos.position)) continue;
-
-			vecMatches.emplace_back(curKmerPos.position, 
-									extReadPos.position,
-									extReadPos.readId);
-		}
+		collectKmerMatches(_vertexIndex.shortIndex(), fastaRec, 
+						   curFilteredPos, vecMatches);
+	}
+	else
+	{
+		collectKmerMatches(_vertexIndex.longIndex(), fastaRec, 
+						   curFilteredPos, vecMatches);
 	}
-	timeKmerIndexFirst += std::chrono::duration_cast<std::chrono::duration<float>>
-							(std::chrono::system_clock::now() - timeStart).count();
-	timeStart = std::chrono::system_clock::now();
+	Profiler::count("ovlp_kmer_matches", vecMatches.size());
+	countTime("ovlp_kmer_lookup_us");
 
 	std::sort(vecMatches.begin(), vecMatches.end(),
 			  [](const KmerMatch& k1, const KmerMatch& k2)
 			  {return k1.extId != k2.extId ? k1.extId < k2.extId : 
 			  								 k1.curPos < k2.curPos;});
 
-	timeKmerIndexSecond += std::chrono::duration_cast<std::chrono::duration<float>>
-								(std::chrono::system_clock::now() - timeStart).count();
-	timeStart = std::chrono::system_clock::now();
+	countTime("ovlp_match_sort_us");
 
 	const int STAT_WND = 10000;
 	std::vector<OverlapRange> divStatWindows(curLen / STAT_WND + 1);
@@ -464,7 +485,8 @@ OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec,
 			{
 				ovlp.seqDivergence = getAlignmentErrEdlib(ovlp, fastaRec.sequence, 
 														   _seqContainer.getSeq(extId),
-														   _maxDivergence, _useHpc);
+														   _maxDivergence, _useHpc, fastaHpc,
+														   _seqContainer.getHpcSeq(extId));
 			}
 
 			if (ovlp.seqDivergence < _maxDivergence)
@@ -477,7 +499,8 @@ OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec,
 				auto trimmedOverlaps = 
 					checkIdyAndTrim(ovlp, fastaRec.sequence, 
 								    _seqContainer.getSeq(extId),
-								    _maxDivergence, _minOverlap, _useHpc);
+								    _maxDivergence, _minOverlap, _useHpc,
+									fastaHpc, _seqContainer.getHpcSeq(extId));
 				for (auto& trimOvlp : trimmedOverlaps)
 				{
 					detectedOverlaps.push_back(trimOvlp);
@@ -493,14 +516,23 @@ OverlapDetector::getSeqOverlaps(const FastaRecord& fastaRec,
 		}
 	}
 
-	timeDp += std::chrono::duration_cast<std::chrono::duration<float>>
-				(std::chrono::system_clock::now() - timeStart).count();
-	timeStart = std::chrono::system_clock::now();
+	Profiler::count("ovlp_detected", detectedOverlaps.size());
+	countTime("ovlp_chaining_us");
 
-	for (const auto& ovlp : divStatWindows)
+	for (auto& ovlp : divStatWindows)
 	{
 		if (ovlp.curRange() > 0)
 		{
+			//base-level divergence above the threshold is not computed
+			//exactly, but we need it for statistics
+			if (_nuclAlignment && ovlp.seqDivergence >= _maxDivergence)
+			{
+				ovlp.seqDivergence = 
+					getAlignmentErrEdlib(ovlp, fastaRec.sequence, 
+										 _seqContainer.getSeq(ovlp.extId),
+										 /*max divergence*/ 1.0f, _useHpc, fastaHpc,
+										 _seqContainer.getHpcSeq(ovlp.extId));
+			}
 			divStats.add(ovlp.seqDivergence);
 		}
 	}
@@ -522,7 +554,8 @@ std::vector<OverlapRange>
 	//bool suggestChimeric;
 	const FastaRecord& record = _queryContainer.getRecord(readId);
 	return _ovlpDetect.getSeqOverlaps(record, forceLocal, 
-									  _divergenceStats, maxOverlaps);
+									  _divergenceStats, maxOverlaps,
+									  _queryContainer.getHpcSeq(readId));
 }
 
 const std::vector<OverlapRange>&
@@ -538,7 +571,9 @@ const std::vector<OverlapRange>&
 			{wrapper = val;});
 	if (wrapper.cached)
 	{
-		return !flipped ? *wrapper.fwdOverlaps : *wrapper.revOverlaps;
+		if (!flipped) return *wrapper.fwdOverlaps;
+		if (!wrapper.revCached) wrapper = this->cacheReverseOverlaps(readId);
+		return *wrapper.revOverlaps;
 	}
 
 	//otherwise, need to compute overlaps.
@@ -548,15 +583,22 @@ const std::vector<OverlapRange>&
 	const FastaRecord& record = _queryContainer.getRecord(readId);
 	auto overlaps = _ovlpDetect.getSeqOverlaps(record, DEFAULT_LOCAL, 
 											   _divergenceStats,
-											   _ovlpDetect._maxCurOverlaps);
+											   _ovlpDetect._maxCurOverlaps,
+											   _queryContainer.getHpcSeq(readId));
 	overlaps.shrink_to_fit();
 
+	//reverse overlaps double the cache size, so they are
+	//not stored in advance if the memory budget is tight
+	bool storeReverse = flipped || !MemoryBudget::get().underPressure();
 	std::vector<OverlapRange> revOverlaps;
-	revOverlaps.reserve(overlaps.size());
-	for (const auto& ovlp : overlaps) revOverlaps.push_back(ovlp.complement());
+	if (storeReverse)
+	{
+		revOverlaps.reserve(overlaps.size());
+		for (const auto& ovlp : overlaps) revOverlaps.push_back(ovlp.complement());
+	}
 
 	_overlapIndex.update_fn(readId,
-		[&wrapper, &overlaps, &revOverlaps, this]
+		[&wrapper, &overlaps, &revOverlaps, storeReverse, this]
 		(IndexVecWrapper& val)
 		{
 			if (!val.cached)
@@ -566,11 +608,38 @@ const std::vector<OverlapRange>&
 				*val.revOverlaps = std::move(revOverlaps);
 				//val.suggestChimeric = suggestChimeric;
 				val.cached = true;
+				val.revCached = storeReverse;
 			}
 			wrapper = val;
 		});
 
-	return !flipped ? *wrapper.fwdOverlaps : *wrapper.revOverlaps;
+	if (!flipped) return *wrapper.fwdOverlaps;
+	if (!wrapper.revCached) wrapper = this->cacheReverseOverlaps(readId);
+	return *wrapper.revOverlaps;
+}
+
+//computes reverse overlaps from the cached forward ones.
+//Safe to call concurrently: the reverse vector is only filled once,
+//and nobody could reference it before that
+OverlapContainer::IndexVecWrapper 
+	OverlapContainer::cacheReverseOverlaps(FastaRecord::Id readId)
+{
+	IndexVecWrapper wrapper;
+	_overlapIndex.update_fn(readId,
+		[&wrapper](IndexVecWrapper& val)
+		{
+			if (!val.revCached)
+			{
+				val.revOverlaps->reserve(val.fwdOverlaps->size());
+				for (const auto& ovlp : *val.fwdOverlaps) 
+				{
+					val.revOverlaps->push_back(ovlp.complement());
+				}
+				val.revCached = true;
+			}
+			wrapper = val;
+		});
+	return wrapper;
 }
 
 void OverlapContainer::ensureTransitivity(bool onlyMaxExt)
@@ -673,6 +742,10 @@ std::vector<OverlapRange>&
 		FastaRecord::Id normId = seqId.strand() ? seqId : seqId.rc();
 		_overlapIndex.insert(normId);	//ensure it's in the table
 		IndexVecWrapper wrapper = _overlapIndex.find(normId);
+		if (!seqId.strand() && wrapper.cached && !wrapper.revCached)
+		{
+			wrapper = this->cacheReverseOverlaps(normId);
+		}
 		return seqId.strand() ? *wrapper.fwdOverlaps : 
 								*wrapper.revOverlaps;
 }
@@ -748,10 +821,13 @@ void OverlapContainer::estimateOverlaperParameters()
 	//const int NEDEED_OVERLAPS = 1000;
 	const int MAX_SEQS = 1000;
 
+	//fixed seed, so the sample is the same in every run
+	const int SAMPLING_SEED = 42;
+	std::mt19937 randGen(SAMPLING_SEED);
 	std::vector<FastaRecord::Id> readsToCheck;
 	for (size_t i = 0; i < MAX_SEQS; ++i) 
 	{
-		size_t randId = rand() % _queryContainer.iterSeqs().size();
+		size_t randId = randGen() % _queryContainer.iterSeqs().size();
 		readsToCheck.push_back(_queryContainer.iterSeqs()[randId].id);
 	}
 
@@ -342,7 +342,8 @@ private:
 	getSeqOverlaps(const FastaRecord& fastaRec, 
 				   bool forceLocal,
 				   OvlpDivStats& divergenceStats,
-				   int maxOverlaps) const;
+				   int maxOverlaps,
+				   const HpcSequence* fastaHpc = nullptr) const;
 
 	bool    overlapTest(const OverlapRange& ovlp, bool forceLocal) const;
 
@@ -384,12 +385,16 @@ public:
 			fwdOverlaps(new std::vector<OverlapRange>), 
 			revOverlaps(new std::vector<OverlapRange>), 
 			cached(false),
+			revCached(false),
 			suggestChimeric(false)
 		{}
 		IndexVecWrapper(const FastaRecord::Id);
 		std::shared_ptr<std::vector<OverlapRange>> fwdOverlaps;
 		std::shared_ptr<std::vector<OverlapRange>> revOverlaps;
 		bool cached;
+		//if memory budget is tight, reverse overlaps are only
+		//computed on demand
+		bool revCached;
 		bool suggestChimeric;
 	};
 	typedef cuckoohash_map<FastaRecord::Id, IndexVecWrapper> OverlapIndex;
@@ -413,6 +418,8 @@ public:
 	size_t indexSize() {return _indexSize;}
 
 	void estimateOverlaperParameters();
+	float getMeanTrueDivergence() const {return _meanTrueOvlpDiv;}
+	void  setMeanTrueDivergence(float div) {_meanTrueOvlpDiv = div;}
 
 	void setDivergenceThreshold(float threshold, bool isRelative);
 
@@ -436,6 +443,7 @@ public:
 
 private:
 	std::vector<OverlapRange>& unsafeSeqOverlaps(FastaRecord::Id);
+	IndexVecWrapper cacheReverseOverlaps(FastaRecord::Id);
 	//std::vector<OverlapRange>  seqOverlaps(FastaRecord::Id readId,
 	//									   bool& outSuggestChimeric) const;
 	void filterOverlaps();
@@ -5,12 +5,15 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <iostream>
 #include <algorithm>
 #include <stdexcept>
 
+#include "../common/arena_allocator.h"
+
 //Immutable dna sequence class
 class DnaSequence
 {
@@ -26,7 +29,7 @@ private:
 		SharedBuffer(): useCount(0), length(0) {}
 		size_t useCount;
 		size_t length;
-		std::vector<size_t> chunks;
+		std::vector<size_t, ArenaAllocator<size_t>> chunks;
 	};
 
 public:
@@ -139,6 +142,8 @@ public:
 
 	DnaSequence substr(size_t start, size_t length) const;
 	std::string str() const;	
+	void copyRaw(size_t start, size_t length, uint8_t* out) const;
+	void append(const DnaSequence& other);
 
 	static size_t dnaToId(char c)
 	{
@@ -214,3 +219,77 @@ inline DnaSequence DnaSequence::substr(size_t start, size_t length) const
 
 	return newSequence;
 }
+
+//appends the other sequence in place, without converting either
+//of them to string. The sequence should not be shared or complemented
+inline void DnaSequence::append(const DnaSequence& other)
+{
+	if (_data->useCount > 1 || _complement) 
+	{
+		throw std::runtime_error("Can't append to a shared sequence");
+	}
+
+	const size_t BLOCK = 4096;
+	uint8_t buffer[BLOCK];
+	size_t pos = _data->length;
+	_data->length += other.length();
+	if (_data->length == 0) return;
+	_data->chunks.resize((_data->length - 1) / NUCL_IN_CHUNK + 1, 0);
+	for (size_t start = 0; start < other.length(); start += BLOCK)
+	{
+		size_t length = std::min(BLOCK, other.length() - start);
+		other.copyRaw(start, length, buffer);
+		for (size_t i = 0; i < length; ++i, ++pos)
+		{
+			_data->chunks[pos / NUCL_IN_CHUNK] |= 
+				(NuclType)buffer[i] << (pos % NUCL_IN_CHUNK) * 2;
+		}
+	}
+}
+
+//copies 2-bit nucleotide ids of the given range into the output
+//buffer, decoding each packed chunk only once
+inline void DnaSequence::copyRaw(size_t start, size_t length, 
+								 uint8_t* out) const
+{
+	if (start + length > _data->length) 
+	{
+		throw std::runtime_error("Incorrect range to copy");
+	}
+
+	if (!_complement)
+	{
+		size_t pos = start;
+		const size_t end = start + length;
+		while (pos < end)
+		{
+			size_t chunk = _data->chunks[pos / NUCL_IN_CHUNK] >>
+						   (pos % NUCL_IN_CHUNK) * 2;
+			size_t chunkEnd = std::min(end, (pos / NUCL_IN_CHUNK + 1) * 
+											NUCL_IN_CHUNK);
+			for (; pos < chunkEnd; ++pos)
+			{
+				*out++ = chunk & 3;
+				chunk >>= 2;
+			}
+		}
+	}
+	else
+	{
+		//reading the forward strand backwards
+		size_t remaining = length;
+		size_t pos = _data->length - start - 1;
+		while (remaining > 0)
+		{
+			size_t inChunk = pos % NUCL_IN_CHUNK;
+			size_t chunk = _data->chunks[pos / NUCL_IN_CHUNK];
+			size_t toCopy = std::min(remaining, inChunk + 1);
+			for (size_t i = 0; i < toCopy; ++i)
+			{
+				*out++ = ~(chunk >> (inChunk - i) * 2) & 3;
+			}
+			remaining -= toCopy;
+			pos -= toCopy;
+		}
+	}
+}
@@ -12,6 +12,8 @@
 
 #include "sequence_container.h"
 #include "../common/logger.h"
+#include "../common/config.h"
+#include "../common/parallel.h"
 
 size_t SequenceContainer::g_nextSeqId = 0;
 
@@ -81,14 +83,17 @@ FastaRecord::Id SequenceContainer::addSequence(const FastaRecord& seqRec)
 void SequenceContainer::loadFromFile(const std::string& fileName, 
 									 int minReadLength)
 {
+	//reads are stored in the memory arena, so the ones that are
+	//shorter than minReadLength are skipped during parsing
+	MemoryArena::Scope arenaScope;
 	std::vector<FastaRecord> records;
 	if (this->isFasta(fileName))
 	{
-		this->readFasta(records, fileName);
+		this->readFasta(records, fileName, minReadLength);
 	}
 	else
 	{
-		this->readFastq(records, fileName);
+		this->readFastq(records, fileName, minReadLength);
 	}
 	
 	//shuffling input reads
@@ -99,10 +104,7 @@ void SequenceContainer::loadFromFile(const std::string& fileName,
 	//for (size_t i : indicesPerm)
 	for (size_t i = 0; i < records.size(); ++i)
 	{
-		if (records[i].sequence.length() > (size_t)minReadLength)
-		{
-			this->addSequence(records[i]);
-		}
+		this->addSequence(records[i]);
 	}
 }
 
@@ -143,7 +145,8 @@ const FastaRecord&
 }
 
 size_t SequenceContainer::readFasta(std::vector<FastaRecord>& record, 
-									const std::string& fileName)
+									const std::string& fileName,
+									size_t minLength)
 {
 	size_t BUF_SIZE = 32 * 1024 * 1024;
 	char* rawBuffer = new char[BUF_SIZE];
@@ -185,8 +188,11 @@ size_t SequenceContainer::readFasta(std::vector<FastaRecord>& record,
 				{
 					if (sequence.empty()) throw ParseException("empty sequence");
 
-					record.emplace_back(DnaSequence(sequence), header, 
-										FastaRecord::ID_NONE);
+					if (sequence.length() > minLength)
+					{
+						record.emplace_back(DnaSequence(sequence), header, 
+											FastaRecord::ID_NONE);
+					}
 					sequence.clear();
 					header.clear();
 				}
@@ -209,8 +215,11 @@ size_t SequenceContainer::readFasta(std::vector<FastaRecord>& record,
 		{
 			throw ParseException("Fasta fromat error");
 		}
-		record.emplace_back(DnaSequence(sequence), header, 
-							FastaRecord::ID_NONE);
+		if (sequence.length() > minLength)
+		{
+			record.emplace_back(DnaSequence(sequence), header, 
+								FastaRecord::ID_NONE);
+		}
 
 	}
 	catch (ParseException& e)
@@ -227,7 +236,8 @@ size_t SequenceContainer::readFasta(std::vector<FastaRecord>& record,
 }
 
 size_t SequenceContainer::readFastq(std::vector<FastaRecord>& record, 
-									const std::string& fileName)
+									const std::string& fileName,
+									size_t minLength)
 {
 
 	size_t BUF_SIZE = 32 * 1024 * 1024;
@@ -277,8 +287,11 @@ size_t SequenceContainer::readFastq(std::vector<FastaRecord>& record,
 			else if (stateCounter == 1)
 			{
 				this->validateSequence(nextLine);
-				record.emplace_back(DnaSequence(nextLine), header, 
-									FastaRecord::ID_NONE);
+				if (nextLine.length() > minLength)
+				{
+					record.emplace_back(DnaSequence(nextLine), header, 
+										FastaRecord::ID_NONE);
+				}
 			}
 			else if (stateCounter == 2)
 			{
@@ -331,59 +344,186 @@ void SequenceContainer::writeFasta(const std::vector<FastaRecord>& records,
 								   const std::string& filename,
 								   bool onlyPositiveStrand)
 {
-	static const size_t FASTA_SLICE = 80;
-
 	Logger::get().debug() << "Writing FASTA";
 	FILE* fout = fopen(filename.c_str(), "w");
 	if (!fout) throw std::runtime_error("Can't open " + filename);
-	
+	setvbuf(fout, nullptr, _IOFBF, 1024 * 1024);
+	writeFasta(records, fout, onlyPositiveStrand);
+	fclose(fout);
+}
+
+//appends records to an already opened file, used for streaming output
+void SequenceContainer::writeFasta(const std::vector<FastaRecord>& records, 
+								   FILE* fout, bool onlyPositiveStrand)
+{
+	static const size_t FASTA_SLICE = 80;
+
 	for (const auto& rec : records)
 	{
 		if (onlyPositiveStrand && !rec.id.strand()) continue;
 
-		std::string contigSeq;
-		for (size_t c = 0; c < rec.sequence.length(); c += FASTA_SLICE)
-		{
-			contigSeq += rec.sequence.substr(c, FASTA_SLICE).str() + "\n";
-		}
 		std::string header = onlyPositiveStrand ? 
 							 ">" + rec.description.substr(1) + "\n":
 							 ">" + rec.description + "\n";
 		fwrite(header.data(), sizeof(header.data()[0]), 
 			   header.size(), fout);
-		fwrite(contigSeq.data(), sizeof(contigSeq.data()[0]), 
-			   contigSeq.size(), fout);
+		writeSequence(rec.sequence, fout, FASTA_SLICE);
 	}
-	fclose(fout);
+}
+
+//decodes the packed sequence block by block directly into the
+//output buffer, each line (if set) ends with a newline
+void SequenceContainer::writeSequence(const DnaSequence& sequence, 
+									  FILE* fout, size_t lineLength)
+{
+	const size_t BLOCK = 64 * 1024;
+	std::vector<uint8_t> nucIds(BLOCK);
+	std::string buffer;
+	buffer.reserve(BLOCK + BLOCK / std::max(lineLength, (size_t)1) + 1);
+	for (size_t start = 0; start < sequence.length(); start += BLOCK)
+	{
+		size_t length = std::min(BLOCK, sequence.length() - start);
+		sequence.copyRaw(start, length, nucIds.data());
+		buffer.clear();
+		for (size_t i = 0; i < length; ++i)
+		{
+			buffer.push_back(DnaSequence::idToDna(nucIds[i]));
+			if (lineLength && (start + i + 1) % lineLength == 0)
+			{
+				buffer.push_back('\n');
+			}
+		}
+		if (lineLength && start + length == sequence.length() &&
+			sequence.length() % lineLength != 0) 
+		{
+			buffer.push_back('\n');
+		}
+		fwrite(buffer.data(), sizeof(buffer[0]), buffer.size(), fout);
+	}
+}
+
+HpcSequence::HpcSequence(const DnaSequence& sequence):
+	_original(sequence), _complement(false)
+{
+	std::vector<uint8_t> rawSeq(sequence.length());
+	if (!rawSeq.empty()) sequence.copyRaw(0, rawSeq.size(), rawSeq.data());
+
+	std::string compressed;
+	for (size_t i = 0; i < rawSeq.size(); ++i)
+	{
+		if (i == 0 || rawSeq[i] != rawSeq[i - 1])
+		{
+			if (compressed.length() % CHECKPOINT_STEP == 0)
+			{
+				_checkpoints.push_back(i);
+			}
+			compressed += DnaSequence::idToDna(rawSeq[i]);
+		}
+	}
+	_fwdCompressed = DnaSequence(compressed);
+	_compressed = _fwdCompressed;
+}
+
+int32_t HpcSequence::fwdCompressed(int32_t origPos) const
+{
+	assert(origPos >= 0 && origPos < (int32_t)_original.length());
+	size_t checkpoint = std::upper_bound(_checkpoints.begin(), _checkpoints.end(),
+										 origPos) - _checkpoints.begin() - 1;
+	int32_t hpcPos = checkpoint * CHECKPOINT_STEP;
+	int32_t runStart = _checkpoints[checkpoint];
+	for (;;)
+	{
+		auto nucl = _original.atRaw(runStart);
+		int32_t runEnd = runStart + 1;
+		while (runEnd < (int32_t)_original.length() && 
+			   _original.atRaw(runEnd) == nucl) ++runEnd;
+
+		if (origPos < runEnd) return hpcPos;
+		runStart = runEnd;
+		++hpcPos;
+	}
+}
+
+int32_t HpcSequence::fwdOriginal(int32_t hpcPos) const
+{
+	assert(hpcPos >= 0 && hpcPos <= (int32_t)_fwdCompressed.length());
+	if (hpcPos == (int32_t)_fwdCompressed.length()) return _original.length();
+
+	int32_t curHpc = hpcPos / CHECKPOINT_STEP * CHECKPOINT_STEP;
+	int32_t runStart = _checkpoints[hpcPos / CHECKPOINT_STEP];
+	for (; curHpc < hpcPos; ++curHpc)
+	{
+		//there is at least one more run, so we never go out of bounds
+		auto nucl = _original.atRaw(runStart);
+		while (_original.atRaw(runStart) == nucl) ++runStart;
+	}
+	return runStart;
+}
+
+void SequenceContainer::buildHpcIndex()
+{
+	if (_hpcIndex.size() == _seqIndex.size()) return;
+
+	Logger::get().debug() << "Compressing homopolymers";
+	//records are stored in pairs of complementary strands
+	std::vector<size_t> newRecords;
+	for (size_t i = _hpcIndex.size(); i < _seqIndex.size(); i += 2)
+	{
+		newRecords.push_back(i);
+	}
+	_hpcIndex.resize(_seqIndex.size());
+
+	std::function<void(const size_t&)> compressFun =
+	[this](const size_t& recId)
+	{
+		_hpcIndex[recId] = HpcSequence(_seqIndex[recId].sequence);
+		_hpcIndex[recId + 1] = _hpcIndex[recId].complement();
+	};
+	processInParallel(newRecords, compressFun, 
+					  Parameters::get().numThreads, false);
 }
 
 void SequenceContainer::buildPositionIndex()
 {
 	Logger::get().debug() << "Building positional index";
 	size_t offset = 0;
-	_sequenceOffsets.reserve(_seqIndex.size());
+	_sequenceOffsets.clear();
+	_sequenceOffsets.reserve(_seqIndex.size() + 1);
+	std::vector<size_t> seqLengths;
+	seqLengths.reserve(_seqIndex.size());
 	for (const auto& seq : _seqIndex)
 	{
 		_sequenceOffsets.push_back({offset, seq.sequence.length()});
 		offset += seq.sequence.length();
+		if (seq.sequence.length() > 0) seqLengths.push_back(seq.sequence.length());
 	}
 	_sequenceOffsets.push_back({offset, 0});
 	if (offset == 0) return;
 
-	_offsetsHint.reserve(offset / CHUNK + 1);
+	//chunk is not longer than most of the sequences (1st percentile).
+	//Even at the minimum chunk, the hints take half of the memory
+	//of the packed sequences (and it is only used for containers
+	//of very short sequences, such as the graph edges)
+	const float SHORT_RATE = 0.01f;
+	std::nth_element(seqLengths.begin(), 
+					 seqLengths.begin() + seqLengths.size() * SHORT_RATE,
+					 seqLengths.end());
+	size_t shortLength = seqLengths[seqLengths.size() * SHORT_RATE];
+	_chunkBits = MIN_CHUNK_BITS;
+	while (_chunkBits < MAX_CHUNK_BITS && 
+		   (1ULL << (_chunkBits + 1)) <= shortLength) ++_chunkBits;
+
+	_offsetsHint.clear();
+	_offsetsHint.reserve(((offset - 1) >> _chunkBits) + 1);
 	size_t idx = 0;
-	for (size_t i = 0; i <= (offset - 1) / CHUNK; ++i)
+	for (size_t i = 0; i <= (offset - 1) >> _chunkBits; ++i)
 	{
-		while (i * CHUNK >= _sequenceOffsets[idx + 1].offset) ++idx;
-		//size_t newIdx = std::upper_bound(_sequenceOffsets.begin(), 
-		//							     _sequenceOffsets.end(),
-		//							     i * CHUNK) - _sequenceOffsets.begin();
-		//Logger::get().debug() << idx << " " << newIdx;
-		//assert(idx == newIdx);
+		while ((i << _chunkBits) >= _sequenceOffsets[idx + 1].offset) ++idx;
 		_offsetsHint.push_back(idx);
 	}
 
 	Logger::get().debug() << "Total sequence: " << offset / 2 << " bp";
+	Logger::get().debug() << "Position index chunk: " << (1ULL << _chunkBits);
 	if (offset >= MAX_SEQUENCE)
 	{
 		Logger::get().error() << "Maximum sequence limit reached ("
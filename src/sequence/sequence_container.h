@@ -5,9 +5,11 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
 #include <unordered_map>
 #include <string>
 #include <limits>
+#include <cstdio>
 
 #include "sequence.h"
 
@@ -44,6 +46,9 @@ struct FastaRecord
 		int signedId() const
 			{return (_id % 2) ? -((int)_id + 1) / 2 : (int)_id / 2 + 1;}
 
+		//ids are dense, so could be used to address arrays
+		size_t index() const {return _id;}
+
 		friend std::ostream& operator << (std::ostream& stream, const Id& id)
 		{
 			stream << std::to_string(id._id);
@@ -133,6 +138,58 @@ namespace std
 	};
 }
 
+//Homopolymer-compressed copy of a sequence. Original positions of
+//every CHECKPOINT_STEP-th compressed nucleotide are stored, so
+//coordinates could be converted in both directions by walking at most
+//CHECKPOINT_STEP runs from the closest checkpoint
+class HpcSequence
+{
+public:
+	HpcSequence(): _complement(false) {}
+	explicit HpcSequence(const DnaSequence& sequence);
+
+	const DnaSequence& compressed() const {return _compressed;}
+
+	//index of the compressed nucleotide that covers the original position
+	int32_t toCompressed(int32_t origPos) const
+	{
+		if (!_complement) return this->fwdCompressed(origPos);
+		return _fwdCompressed.length() - 1 - 
+			this->fwdCompressed(_original.length() - 1 - origPos);
+	}
+
+	//original position of the first nucleotide of the compressed run
+	int32_t toOriginal(int32_t hpcPos) const
+	{
+		if (!_complement) return this->fwdOriginal(hpcPos);
+		return _original.length() - 
+			this->fwdOriginal(_fwdCompressed.length() - hpcPos);
+	}
+
+	HpcSequence complement() const
+	{
+		HpcSequence complHpc(*this);
+		complHpc._complement = !_complement;
+		complHpc._compressed = complHpc._complement ? 
+							   _fwdCompressed.complement() : _fwdCompressed;
+		return complHpc;
+	}
+
+private:
+	static const int32_t CHECKPOINT_STEP = 64;
+
+	int32_t fwdCompressed(int32_t origPos) const;
+	int32_t fwdOriginal(int32_t hpcPos) const;
+
+	//checkpoints are computed wrt to the strand of _original,
+	//complementary coordinates are converted on the fly
+	DnaSequence _original;
+	DnaSequence _fwdCompressed;
+	DnaSequence _compressed;
+	std::vector<int32_t> _checkpoints;
+	bool _complement;
+};
+
 class SequenceContainer
 {
 public:
@@ -147,13 +204,18 @@ public:
 	typedef std::vector<FastaRecord> SequenceIndex;
 
 	SequenceContainer():
-		_offsetInitialized(false) {}
+		_offsetInitialized(false), _chunkBits(MAX_CHUNK_BITS) {}
 
 	void loadFromFile(const std::string& filename, int minReadLength = 0);
 
 	static void writeFasta(const std::vector<FastaRecord>& records,
 						   const std::string& fileName,
 						   bool  onlyPositiveStrand = false);
+	static void writeFasta(const std::vector<FastaRecord>& records,
+						   FILE* fout, bool onlyPositiveStrand = false);
+	//lineLength = 0 writes the whole sequence in a single line
+	static void writeSequence(const DnaSequence& sequence, FILE* fout,
+							  size_t lineLength = 0);
 
 	static size_t getMaxSeqId() {return g_nextSeqId;}
 
@@ -197,6 +259,18 @@ public:
 
 	void   buildPositionIndex();
 
+	//computes homopolymer-compressed sequences for all records
+	//that were added since the previous call
+	void   buildHpcIndex();
+
+	//returns nullptr if the compressed sequence was not precomputed
+	const HpcSequence* getHpcSeq(FastaRecord::Id seqId) const
+	{
+		assert(seqId._id - _seqIdOffest < _seqIndex.size());
+		if (seqId._id - _seqIdOffest >= _hpcIndex.size()) return nullptr;
+		return &_hpcIndex[seqId._id - _seqIdOffest];
+	}
+
 	size_t globalPosition(FastaRecord::Id seqId, int32_t position) const
 	{
 		assert(position >= 0 && position < this->seqLen(seqId));
@@ -222,8 +296,20 @@ public:
 	{
 		assert(globPos < _sequenceOffsets.back().offset);
 
-		size_t hint = _offsetsHint[globPos / CHUNK];
-		while (_sequenceOffsets[hint + 1].offset <= globPos) ++hint;
+		size_t chunkId = globPos >> _chunkBits;
+		size_t hint = _offsetsHint[chunkId];
+		if (_sequenceOffsets[hint + 1].offset <= globPos)
+		{
+			//a dense chunk with multiple sequence starts: the sequence
+			//is between this and the next chunk's hints
+			size_t lastSeq = chunkId + 1 < _offsetsHint.size() ? 
+							 _offsetsHint[chunkId + 1] : _sequenceOffsets.size() - 2;
+			hint = std::upper_bound(_sequenceOffsets.begin() + hint + 1,
+									_sequenceOffsets.begin() + lastSeq + 1, globPos,
+									[](size_t pos, const OffsetPair& seqOffset)
+									{return pos < seqOffset.offset;}) - 
+				   _sequenceOffsets.begin() - 1;
+		}
 
 		outSeqId = FastaRecord::Id(_seqIdOffest + hint);
 		outPosition = globPos - _sequenceOffsets[hint].offset;
@@ -233,6 +319,11 @@ public:
 		assert(outPosition >= 0 && outPosition < outLen);
 		//assert(this->globalPosition(outSeqId, outPosition) == globPos);
 	}
+	void prefetchPosition(size_t globPos) const
+	{
+		__builtin_prefetch(&_offsetsHint[globPos >> _chunkBits]);
+	}
+
 	static size_t g_nextSeqId;
 
 private:
@@ -245,10 +336,10 @@ private:
 	FastaRecord::Id addSequence(const FastaRecord& sequence);
 
 	size_t readFasta(std::vector<FastaRecord>& record, 
-				     const std::string& fileName);
+				     const std::string& fileName, size_t minLength);
 
 	size_t readFastq(std::vector<FastaRecord>& record, 
-				     const std::string& fileName);
+				     const std::string& fileName, size_t minLength);
 
 	bool   isFasta(const std::string& fileName);
 
@@ -262,10 +353,20 @@ private:
 	std::unordered_map<std::string, 
 					   FastaRecord::Id> _nameIndex;
 
-	//global/local position convertions
+	//global/local position convertions. Global positions are split
+	//into chunks (of a power of two size), and for each chunk the first
+	//sequence that overlaps it is stored. The chunk size is adapted to the
+	//sequence lengths, so that a chunk rarely contains multiple sequence
+	//starts, and the translation is a single lookup. Chunks with multiple
+	//starts (only possible for sequences shorter than the chunk) are
+	//resolved with a binary search between the adjacent hints
 	const size_t MAX_SEQUENCE = 1ULL << (8 * 5);
-	const size_t CHUNK = 1000;
+	static const size_t MIN_CHUNK_BITS = 5;
+	static const size_t MAX_CHUNK_BITS = 10;
 	std::vector<OffsetPair> _sequenceOffsets;
-	std::vector<size_t> 	_offsetsHint;
+	std::vector<uint32_t> 	_offsetsHint;
+	size_t 					_chunkBits;
+
+	std::vector<HpcSequence> _hpcIndex;
 };
 
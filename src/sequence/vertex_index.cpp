@@ -8,33 +8,243 @@
 #include <algorithm>
 #include <queue>
 #include <cmath>
+#include <mutex>
+#include <numeric>
 
 #include "vertex_index.h"
 #include "../common/logger.h"
 #include "../common/parallel.h"
 #include "../common/config.h"
 #include "../common/memory_info.h"
+#include "../common/memory_budget.h"
 
 
-void VertexIndex::countKmers()
+template <class KmerT>
+void BasicVertexIndex<KmerT>::countKmers()
 {
-	_kmerCounter.count(/*use flat counter*/ true);
+	//flat counter is faster, but takes 4^k / 2 bytes regardless
+	//of the input size. Fall back to the hash counter if it does not fit
+	bool useFlatCounter = Parameters::get().kmerSize <= 17;
+	if (useFlatCounter)
+	{
+		size_t flatSize = std::pow(4, Parameters::get().kmerSize) / 2;
+		if (!MemoryBudget::get().fits(flatSize))
+		{
+			Logger::get().debug() << "Flat k-mer counter (" 
+				<< flatSize / 1024 / 1024 << " Mb) does not fit into "
+				<< "the memory budget, using hash counter";
+			useFlatCounter = false;
+		}
+	}
+	_kmerCounter.count(useFlatCounter);
 }
 
 
-void VertexIndex::buildIndexUnevenCoverage(int globalMinFreq, float selectRate,
-										   int tandemFreq)
+namespace
+{
+	//k-mer occurence, as collected by the single-pass index builder
+	template <class KmerT>
+	struct KmerOccurence
+	{
+		typename KmerT::KmerRepr kmer;
+		size_t globPos;
+
+		bool operator<(const KmerOccurence<KmerT>& other) const
+		{
+			return kmer != other.kmer ? kmer < other.kmer : 
+										globPos < other.globPos;
+		}
+	};
+}
+
+template <class KmerT>
+void BasicVertexIndex<KmerT>::buildIndexUnevenCoverage(int globalMinFreq, float selectRate,
+													   int tandemFreq)
 {
 	//this->setRepeatCutoff(globalMinFreq);
 
 	//_solidMultiplier = 1;
 
 	std::vector<FastaRecord::Id> allReads;
+	size_t totalLen = 0;
 	for (const auto& seq : _seqContainer.iterSeqs())
 	{
 		allReads.push_back(seq.id);
+		if (seq.id.strand()) totalLen += seq.sequence.length();
+	}
+
+	//the single-pass builder keeps all selected k-mer occurences 
+	//(about selectRate of all k-mers) before grouping them, which
+	//takes a few times more memory than the index itself
+	size_t bufferSize = totalLen * selectRate * sizeof(KmerOccurence<KmerT>);
+	if (MemoryBudget::get().fits(2 * bufferSize))
+	{
+		this->fillIndexSinglePass(allReads, globalMinFreq, selectRate, 
+								  tandemFreq);
+	}
+	else
+	{
+		Logger::get().debug() << "K-mer occurences buffer (" 
+			<< bufferSize / 1024 / 1024 << " Mb) does not fit into "
+			<< "the memory budget, building the index in two passes";
+		this->fillIndexTwoPass(allReads, globalMinFreq, selectRate, 
+							   tandemFreq);
 	}
 
+	_kmerCounter.clear();
+	this->buildKmerFilter();
+	
+	size_t totalEntries = 0;
+	for (const auto& kmerRec : _kmerIndex.lock_table())
+	{
+		totalEntries += kmerRec.second.size;
+	}
+	Logger::get().debug() << "Selected k-mers: " << _kmerIndex.size();
+	Logger::get().debug() << "Index size: " << totalEntries;
+	Logger::get().debug() << "Mean k-mer index frequency: " 
+		<< (float)totalEntries / _kmerIndex.size();
+}
+
+//Reads are scanned once, and the selected k-mer occurences are
+//distributed into partitions by k-mer hash. Each partition is then
+//sorted, which groups the occurences of the same k-mer (with sorted
+//positions), so they could be copied directly into the index
+template <class KmerT>
+void BasicVertexIndex<KmerT>::fillIndexSinglePass(const std::vector<FastaRecord::Id>& allReads,
+												  int globalMinFreq, float selectRate,
+												  int tandemFreq)
+{
+	const size_t NUM_PARTITIONS = 256;
+	const size_t READS_BATCH = 64;
+
+	std::vector<std::vector<KmerOccurence<KmerT>>> partitions(NUM_PARTITIONS);
+	std::vector<std::mutex> partitionLocks(NUM_PARTITIONS);
+	std::vector<size_t> batches;
+	for (size_t i = 0; i < allReads.size(); i += READS_BATCH) batches.push_back(i);
+
+	if (_outputProgress) Logger::get().info() << "Filling index table";
+	std::function<void(const size_t&)> scanReads = 
+	[this, &allReads, &partitions, &partitionLocks, globalMinFreq, 
+	 selectRate, tandemFreq, NUM_PARTITIONS, READS_BATCH] 
+	(const size_t& batchStart)
+	{
+		std::vector<std::vector<KmerOccurence<KmerT>>> localParts(NUM_PARTITIONS);
+		size_t batchEnd = std::min(batchStart + READS_BATCH, allReads.size());
+		for (size_t readIdx = batchStart; readIdx < batchEnd; ++readIdx)
+		{
+			FastaRecord::Id readId = allReads[readIdx];
+			if (!readId.strand()) continue;
+
+			auto topKmers = this->yieldFrequentKmers(readId, selectRate, tandemFreq);
+			for (auto kmerFreq : topKmers)
+			{
+				if (kmerFreq.freq < (size_t)globalMinFreq) continue;
+
+				BasicKmerPosition<KmerT> kmerPos(kmerFreq.kmer, kmerFreq.position);
+				FastaRecord::Id targetRead = readId;
+				bool revCmp = kmerPos.kmer.standardForm();
+				if (revCmp)
+				{
+					kmerPos.position = _seqContainer.seqLen(readId) - 
+											kmerPos.position -
+											Parameters::get().kmerSize;
+					targetRead = targetRead.rc();
+				}
+				size_t globPos = _seqContainer
+						.globalPosition(targetRead, kmerPos.position);
+				localParts[kmerPos.kmer.hash() % NUM_PARTITIONS]
+					.push_back({kmerPos.kmer.numRepr(), globPos});
+			}
+		}
+		for (size_t part = 0; part < NUM_PARTITIONS; ++part)
+		{
+			if (localParts[part].empty()) continue;
+			std::lock_guard<std::mutex> lock(partitionLocks[part]);
+			partitions[part].insert(partitions[part].end(), 
+									localParts[part].begin(), 
+									localParts[part].end());
+		}
+	};
+	processInParallel(batches, scanReads, 
+					  Parameters::get().numThreads, _outputProgress);
+
+	std::vector<size_t> partitionIds(NUM_PARTITIONS);
+	std::iota(partitionIds.begin(), partitionIds.end(), 0);
+	std::atomic<size_t> numKmers(0);
+	std::function<void(const size_t&)> sortPartition = 
+	[&partitions, &numKmers] (const size_t& part)
+	{
+		auto& occurences = partitions[part];
+		std::sort(occurences.begin(), occurences.end());
+		for (size_t i = 0; i < occurences.size(); ++i)
+		{
+			if (i == 0 || occurences[i].kmer != occurences[i - 1].kmer) ++numKmers;
+		}
+	};
+	processInParallel(partitionIds, sortPartition, 
+					  Parameters::get().numThreads, false);
+
+	//calls the function for each group of the same k-mer occurences
+	auto forEachKmer = [&partitions](size_t part, 
+		std::function<void(KmerT, const KmerOccurence<KmerT>*, size_t)> fun)
+	{
+		const auto& occurences = partitions[part];
+		size_t groupStart = 0;
+		for (size_t i = 1; i <= occurences.size(); ++i)
+		{
+			if (i == occurences.size() || 
+				occurences[i].kmer != occurences[groupStart].kmer)
+			{
+				fun(KmerT(occurences[groupStart].kmer), 
+					&occurences[groupStart], i - groupStart);
+				groupStart = i;
+			}
+		}
+	};
+
+	_kmerIndex.reserve(numKmers);
+	std::function<void(const size_t&)> insertKmers = 
+	[this, &forEachKmer] (const size_t& part)
+	{
+		forEachKmer(part, [this](KmerT kmer, const KmerOccurence<KmerT>*, size_t num)
+		{
+			_kmerIndex.insert(kmer, ReadVector((uint32_t)num, 0));
+		});
+	};
+	processInParallel(partitionIds, insertKmers, 
+					  Parameters::get().numThreads, false);
+
+	this->filterFrequentKmers(globalMinFreq, (float)Config::get("repeat_kmer_rate"));
+	this->allocateIndexMemory();
+
+	//k-mers with the global frequency above the repetitive cutoff are
+	//not filled (but kept in the index), same as in the two-pass builder
+	std::function<void(const size_t&)> fillKmers = 
+	[this, &forEachKmer, &partitions] (const size_t& part)
+	{
+		forEachKmer(part, [this](KmerT kmer, const KmerOccurence<KmerT>* occurences, 
+								 size_t num)
+		{
+			ReadVector rv;
+			if (!_kmerIndex.find(kmer, rv)) return;
+			if (_kmerCounter.getFreq(kmer) > _repetitiveFrequency) return;
+
+			for (size_t i = 0; i < num; ++i) rv.data[i].set(occurences[i].globPos);
+			_kmerIndex.update_fn(kmer, [num](ReadVector& rv){rv.size = num;});
+		});
+		partitions[part] = std::vector<KmerOccurence<KmerT>>();
+	};
+	processInParallel(partitionIds, fillKmers, 
+					  Parameters::get().numThreads, false);
+}
+
+//lower-memory builder: first counts the number of occurences of each 
+//k-mer in the index table, then fills the allocated position arrays
+template <class KmerT>
+void BasicVertexIndex<KmerT>::fillIndexTwoPass(const std::vector<FastaRecord::Id>& allReads,
+											   int globalMinFreq, float selectRate,
+											   int tandemFreq)
+{
 	//first, count the number of k-mers that will be actually stored in the index
 	_kmerIndex.reserve(_kmerCounter.getKmerNum() / 10);
 	if (_outputProgress) Logger::get().info() << "Filling index table (1/2)";
@@ -73,7 +283,7 @@ void VertexIndex::buildIndexUnevenCoverage(int globalMinFreq, float selectRate,
 			if (kmerFreq.freq < (size_t)globalMinFreq ||
 				kmerFreq.freq > _repetitiveFrequency) continue;
 
-			KmerPosition kmerPos(kmerFreq.kmer, kmerFreq.position);
+			BasicKmerPosition<KmerT> kmerPos(kmerFreq.kmer, kmerFreq.position);
 			FastaRecord::Id targetRead = readId;
 			bool revCmp = kmerPos.kmer.standardForm();
 			if (revCmp)
@@ -103,25 +313,7 @@ void VertexIndex::buildIndexUnevenCoverage(int globalMinFreq, float selectRate,
 	processInParallel(allReads, indexUpdate, 
 					  Parameters::get().numThreads, _outputProgress);
 
-	_kmerCounter.clear();
-
-	Logger::get().debug() << "Sorting k-mer index";
-	for (const auto& kmerVec : _kmerIndex.lock_table())
-	{
-		std::sort(kmerVec.second.data, kmerVec.second.data + kmerVec.second.size,
-				  [](const IndexChunk& p1, const IndexChunk& p2)
-				  	{return p1.get() < p2.get();});
-	}
-	
-	size_t totalEntries = 0;
-	for (const auto& kmerRec : _kmerIndex.lock_table())
-	{
-		totalEntries += kmerRec.second.size;
-	}
-	Logger::get().debug() << "Selected k-mers: " << _kmerIndex.size();
-	Logger::get().debug() << "Index size: " << totalEntries;
-	Logger::get().debug() << "Mean k-mer index frequency: " 
-		<< (float)totalEntries / _kmerIndex.size();
+	this->sortIndexPositions();
 }
 
 namespace
@@ -170,7 +362,8 @@ namespace
 						  filteredRate << ")";
 }*/
 
-void VertexIndex::filterFrequentKmers(int minCoverage, float rate)
+template <class KmerT>
+void BasicVertexIndex<KmerT>::filterFrequentKmers(int minCoverage, float rate)
 {
 	size_t totalKmers = 0;
 	size_t uniqueKmers = 0;
@@ -313,16 +506,17 @@ void VertexIndex::filterFrequentKmers(int minCoverage, float rate)
 		<< (float)kmerEntries / solidKmers;
 }*/
 
-std::vector<VertexIndex::KmerFreq>
-	VertexIndex::yieldFrequentKmers(const FastaRecord::Id& seqId,
-									float selectRate, int tandemFreq)
+template <class KmerT>
+std::vector<typename BasicVertexIndex<KmerT>::KmerFreq>
+	BasicVertexIndex<KmerT>::yieldFrequentKmers(const FastaRecord::Id& seqId,
+												float selectRate, int tandemFreq)
 {
-	thread_local std::unordered_map<Kmer, size_t> localFreq;
+	thread_local std::unordered_map<KmerT, size_t> localFreq;
 	localFreq.clear();
 	std::vector<KmerFreq> topKmers;
 	topKmers.reserve(_seqContainer.seqLen(seqId));
 
-	for (const auto& kmerPos : IterKmers(_seqContainer.getSeq(seqId)))
+	for (const auto& kmerPos : BasicIterKmers<KmerT>(_seqContainer.getSeq(seqId)))
 	{
 		auto stdKmer = kmerPos.kmer;
 		stdKmer.standardForm();
@@ -359,14 +553,193 @@ std::vector<VertexIndex::KmerFreq>
 
 
 
-void VertexIndex::allocateIndexMemory()
+//If the index does not fit into the memory budget, the most frequent
+//k-mers are marked as repetitive (and not indexed), which is similar
+//to the regular repetitive k-mer filtering, but with a lower cutoff
+template <class KmerT>
+void BasicVertexIndex<KmerT>::fitIndexIntoBudget(size_t padding)
+{
+	std::map<size_t, size_t> capacityHist;
+	size_t totalEntries = 0;
+	for (const auto& kmer : _kmerIndex.lock_table())
+	{
+		capacityHist[kmer.second.capacity] += 1;
+		totalEntries += kmer.second.capacity + padding;
+	}
+	size_t budgetEntries = MemoryBudget::get().getAvailable() * 0.9f / 
+						   sizeof(IndexChunk);
+	if (totalEntries <= budgetEntries) return;
+
+	//solid k-mers (with frequencies around the weighted median, which
+	//is close to the read coverage) are always kept, otherwise the index
+	//becomes useless
+	size_t medianCapacity = 0;
+	size_t cumEntries = 0;
+	for (const auto& capCount : capacityHist)
+	{
+		cumEntries += (capCount.first + padding) * capCount.second;
+		medianCapacity = capCount.first;
+		if (cumEntries >= totalEntries / 2) break;
+	}
+	const size_t minCutoff = std::max(2UL, 2 * medianCapacity);
+	size_t newCutoff = _repetitiveFrequency;
+	for (auto histIt = capacityHist.rbegin(); 
+		 histIt != capacityHist.rend() && totalEntries > budgetEntries; ++histIt)
+	{
+		if (histIt->first <= minCutoff)
+		{
+			Logger::get().warning() << "K-mer index is likely to exceed "
+				<< "the memory budget";
+			break;
+		}
+		totalEntries -= (histIt->first + padding) * histIt->second;
+		newCutoff = histIt->first - 1;
+	}
+	if (newCutoff >= _repetitiveFrequency) return;
+
+	std::vector<KmerT> toRemove;
+	for (const auto& kmer : _kmerIndex.lock_table())
+	{
+		if (kmer.second.capacity > newCutoff) toRemove.push_back(kmer.first);
+	}
+	for (const auto& kmer : toRemove)
+	{
+		_kmerIndex.erase(kmer);
+		_repetitiveKmers.insert(kmer, true);
+	}
+	Logger::get().warning() << "K-mer index does not fit into the memory budget, "
+		<< "repetitive k-mer frequency cutoff is lowered from " 
+		<< _repetitiveFrequency << " to " << newCutoff;
+	_repetitiveFrequency = newCutoff;
+}
+
+//the position arrays are collected from the table first, so they
+//could be sorted in parallel without holding the table lock
+template <class KmerT>
+void BasicVertexIndex<KmerT>::sortIndexPositions()
+{
+	Logger::get().debug() << "Sorting k-mer index";
+	const size_t BATCH = 4096;
+
+	std::vector<ReadVector> kmerVectors;
+	kmerVectors.reserve(_kmerIndex.size());
+	for (const auto& kmerVec : _kmerIndex.lock_table())
+	{
+		if (kmerVec.second.size > 1) kmerVectors.push_back(kmerVec.second);
+	}
+
+	std::vector<size_t> batches;
+	for (size_t i = 0; i < kmerVectors.size(); i += BATCH) batches.push_back(i);
+	std::function<void(const size_t&)> sortBatch = 
+	[&kmerVectors, BATCH] (const size_t& batchStart)
+	{
+		size_t batchEnd = std::min(batchStart + BATCH, kmerVectors.size());
+		for (size_t i = batchStart; i < batchEnd; ++i)
+		{
+			std::sort(kmerVectors[i].data, kmerVectors[i].data + kmerVectors[i].size,
+					  [](const IndexChunk& p1, const IndexChunk& p2)
+						{return p1.get() < p2.get();});
+		}
+	};
+	processInParallel(batches, sortBatch, 
+					  Parameters::get().numThreads, false);
+}
+
+//Filter over the k-mers that are reported by lookupKmer: the repetitive ones
+//and the solid ones with non-empty positions. It takes a couple of bytes
+//per k-mer, which is much less than the hash tables, so the queries
+//for the absent k-mers mostly hit the cache
+template <class KmerT>
+void BasicVertexIndex<KmerT>::buildKmerFilter()
+{
+	const size_t BITS_PER_KMER = 16;
+
+	_kmerFilter.clear();
+	auto indexTable = _kmerIndex.lock_table();
+	auto repetitiveTable = _repetitiveKmers.lock_table();
+	size_t numKmers = indexTable.size() + repetitiveTable.size();
+	size_t filterSize = BlockedBloomFilter::memoryRequired(numKmers, 
+														   BITS_PER_KMER);
+	if (!MemoryBudget::get().fits(filterSize))
+	{
+		Logger::get().debug() << "K-mer filter (" << filterSize / 1024 / 1024
+			<< " Mb) does not fit into the memory budget, skipping";
+		return;
+	}
+
+	_kmerFilter.init(numKmers, BITS_PER_KMER);
+	for (const auto& kmer : indexTable)
+	{
+		if (kmer.second.size > 0) _kmerFilter.insert(kmer.first.hash());
+	}
+	for (const auto& kmer : repetitiveTable)
+	{
+		_kmerFilter.insert(kmer.first.hash());
+	}
+	Logger::get().debug() << "K-mer filter size: " << filterSize / 1024 / 1024
+		<< " Mb";
+}
+
+template <class KmerT>
+void BasicVertexIndex<KmerT>::lookupKmers(const std::vector<BasicKmerPosition<KmerT>>& kmers,
+										  std::vector<KmerLookup>& out) const
+{
+	const size_t MAX_BATCH = 64;
+	if (kmers.size() > MAX_BATCH)
+	{
+		throw std::runtime_error("Too many k-mers in a lookup batch");
+	}
+
+	KmerT stdKmers[MAX_BATCH];
+	size_t hashes[MAX_BATCH];
+	bool revComp[MAX_BATCH];
+	for (size_t i = 0; i < kmers.size(); ++i)
+	{
+		stdKmers[i] = kmers[i].kmer;
+		revComp[i] = stdKmers[i].standardForm();
+		hashes[i] = stdKmers[i].hash();
+		_kmerFilter.prefetch(hashes[i]);
+	}
+
+	bool passed[MAX_BATCH];
+	for (size_t i = 0; i < kmers.size(); ++i)
+	{
+		passed[i] = _kmerFilter.mayContain(hashes[i]);
+		if (passed[i]) _kmerIndex.prefetch(stdKmers[i]);
+	}
+
+	out.clear();
+	for (size_t i = 0; i < kmers.size(); ++i)
+	{
+		ReadVector rv;
+		bool repetitive = passed[i] && !_kmerIndex.find(stdKmers[i], rv) &&
+						  _repetitiveKmers.contains(stdKmers[i]);
+		out.push_back({repetitive, IterHelper(rv, revComp[i], _seqContainer)});
+		out.back().positions.prefetchData();
+	}
+}
+
+template <class KmerT>
+typename BasicVertexIndex<KmerT>::IndexChunk* 
+	BasicVertexIndex<KmerT>::allocateChunk()
+{
+	return (IndexChunk*)MemoryArena::get()
+		.allocateRegion(MEM_CHUNK * sizeof(IndexChunk));
+}
+
+template <class KmerT>
+void BasicVertexIndex<KmerT>::allocateIndexMemory()
 {
-	_memoryChunks.push_back(new IndexChunk[MEM_CHUNK]);
-	size_t chunkOffset = 0;
 	//Important: since packed structures are apparently not thread-safe,
 	//make sure that adjacent k-mer index arrays (that are accessed in parallel)
 	//do not overlap within 8-byte window
 	const size_t PADDING = 1;
+	this->fitIndexIntoBudget(PADDING);
+
+	//the chunks are mapped from the arena, which zero-initializes
+	//them (same as IndexChunk constructor)
+	_memoryChunks.push_back(this->allocateChunk());
+	size_t chunkOffset = 0;
 	for (auto& kmer : _kmerIndex.lock_table())
 	{
 		if (MEM_CHUNK < kmer.second.capacity + PADDING) 
@@ -375,7 +748,7 @@ void VertexIndex::allocateIndexMemory()
 		}
 		if (MEM_CHUNK - chunkOffset < kmer.second.capacity + PADDING)
 		{
-			_memoryChunks.push_back(new IndexChunk[MEM_CHUNK]);
+			_memoryChunks.push_back(this->allocateChunk());
 			chunkOffset = 0;
 		}
 		kmer.second.data = _memoryChunks.back() + chunkOffset;
@@ -386,7 +759,8 @@ void VertexIndex::allocateIndexMemory()
 	//	<< " wasted space: " << wasted;
 }
 
-void VertexIndex::buildIndexMinimizers(int minCoverage, int wndLen)
+template <class KmerT>
+void BasicVertexIndex<KmerT>::buildIndexMinimizers(int minCoverage, int wndLen)
 {
 	if (_outputProgress) Logger::get().info() << "Building minimizer index";
 
@@ -405,7 +779,7 @@ void VertexIndex::buildIndexMinimizers(int minCoverage, int wndLen)
 	{
 		if (!readId.strand()) return;
 
-		auto minimizers = yieldMinimizers(_seqContainer.getSeq(readId), wndLen);
+		auto minimizers = yieldMinimizers<KmerT>(_seqContainer.getSeq(readId), wndLen);
 		for (auto kmerPos : minimizers)
 		{
 			auto stdKmer = kmerPos.kmer;
@@ -426,7 +800,7 @@ void VertexIndex::buildIndexMinimizers(int minCoverage, int wndLen)
 	[this, minCoverage, wndLen] (const FastaRecord::Id& readId)
 	{
 		if (!readId.strand()) return;
-		auto minimizers = yieldMinimizers(_seqContainer.getSeq(readId), wndLen);
+		auto minimizers = yieldMinimizers<KmerT>(_seqContainer.getSeq(readId), wndLen);
 		for (auto kmerPos : minimizers)
 		{
 			FastaRecord::Id targetRead = readId;
@@ -459,13 +833,8 @@ void VertexIndex::buildIndexMinimizers(int minCoverage, int wndLen)
 	processInParallel(allReads, indexUpdate, 
 					  Parameters::get().numThreads, _outputProgress);
 
-	Logger::get().debug() << "Sorting k-mer index";
-	for (const auto& kmerVec : _kmerIndex.lock_table())
-	{
-		std::sort(kmerVec.second.data, kmerVec.second.data + kmerVec.second.size,
-				  [](const IndexChunk& p1, const IndexChunk& p2)
-				  	{return p1.get() < p2.get();});
-	}
+	this->sortIndexPositions();
+	this->buildKmerFilter();
 	
 	size_t totalEntries = 0;
 	for (const auto& kmerRec : _kmerIndex.lock_table())
@@ -483,20 +852,124 @@ void VertexIndex::buildIndexMinimizers(int minCoverage, int wndLen)
 }
 
 
-void VertexIndex::clear()
+namespace
+{
+	template <class T>
+	void writeValue(std::ostream& out, const T& value)
+	{
+		out.write((const char*)&value, sizeof(T));
+	}
+
+	template <class T>
+	T readValue(std::istream& in)
+	{
+		T value;
+		if (!in.read((char*)&value, sizeof(T)))
+		{
+			throw std::runtime_error("Unexpected end of index file");
+		}
+		return value;
+	}
+}
+
+//k-mers and the sizes of their position arrays go first,
+//so the memory could be allocated before reading the positions
+template <class KmerT>
+void BasicVertexIndex<KmerT>::saveIndex(std::ostream& out)
+{
+	writeValue<float>(out, _sampleRate);
+	writeValue<uint64_t>(out, _repetitiveFrequency);
+
+	auto repetitiveTable = _repetitiveKmers.lock_table();
+	writeValue<uint64_t>(out, repetitiveTable.size());
+	for (const auto& kmer : repetitiveTable)
+	{
+		KmerT repr = kmer.first;
+		writeValue<typename KmerT::KmerRepr>(out, repr.numRepr());
+	}
+	repetitiveTable.unlock();
+
+	auto indexTable = _kmerIndex.lock_table();
+	writeValue<uint64_t>(out, indexTable.size());
+	for (const auto& kmer : indexTable)
+	{
+		KmerT repr = kmer.first;
+		writeValue<typename KmerT::KmerRepr>(out, repr.numRepr());
+		writeValue<uint32_t>(out, kmer.second.size);
+	}
+	for (const auto& kmer : indexTable)
+	{
+		out.write((const char*)kmer.second.data, 
+				  kmer.second.size * sizeof(IndexChunk));
+	}
+}
+
+template <class KmerT>
+void BasicVertexIndex<KmerT>::loadIndex(std::istream& in)
+{
+	this->clear();
+	_sampleRate = readValue<float>(in);
+	_repetitiveFrequency = readValue<uint64_t>(in);
+
+	size_t numRepetitive = readValue<uint64_t>(in);
+	for (size_t i = 0; i < numRepetitive; ++i)
+	{
+		_repetitiveKmers.insert(KmerT(readValue<typename KmerT::KmerRepr>(in)), true);
+	}
+
+	size_t numKmers = readValue<uint64_t>(in);
+	std::vector<std::pair<KmerT, uint32_t>> kmerSizes;
+	kmerSizes.reserve(numKmers);
+	_kmerIndex.reserve(numKmers);
+	for (size_t i = 0; i < numKmers; ++i)
+	{
+		KmerT kmer(readValue<typename KmerT::KmerRepr>(in));
+		uint32_t size = readValue<uint32_t>(in);
+		kmerSizes.emplace_back(kmer, size);
+		_kmerIndex.insert(kmer, ReadVector(size, 0));
+	}
+	this->allocateIndexMemory();
+
+	for (const auto& kmerSize : kmerSizes)
+	{
+		ReadVector rv;
+		//the k-mer could be dropped to fit into the memory budget
+		if (!_kmerIndex.find(kmerSize.first, rv))
+		{
+			in.ignore(kmerSize.second * sizeof(IndexChunk));
+			continue;
+		}
+		if (!in.read((char*)rv.data, kmerSize.second * sizeof(IndexChunk)))
+		{
+			throw std::runtime_error("Unexpected end of index file");
+		}
+		_kmerIndex.update_fn(kmerSize.first, 
+							 [&kmerSize](ReadVector& rv){rv.size = kmerSize.second;});
+	}
+	this->buildKmerFilter();
+	Logger::get().debug() << "Loaded k-mers: " << _kmerIndex.size();
+}
+
+template <class KmerT>
+void BasicVertexIndex<KmerT>::clear()
 {
-	for (auto& chunk : _memoryChunks) delete[] chunk;
+	for (auto& chunk : _memoryChunks)
+	{
+		MemoryArena::get().freeRegion(chunk, MEM_CHUNK * sizeof(IndexChunk));
+	}
 	_memoryChunks.clear();
 
 	_kmerIndex.clear();
 	_kmerIndex.reserve(0);
+	_kmerFilter.clear();
 
 	_kmerCounter.clear();
 	//_kmerCounts.reserve(0);
 }
 
 
-void KmerCounter::count(bool useFlatCounter)
+template <class KmerT>
+void BasicKmerCounter<KmerT>::count(bool useFlatCounter)
 {
 	//Logger::get().debug() << "Before counter: " 
 	//	<< getPeakRSS() / 1024 / 1024 / 1024 << " Gb";
@@ -508,12 +981,13 @@ void KmerCounter::count(bool useFlatCounter)
 	_useFlatCounter = useFlatCounter;
 
 	//flat array for all possible k-mers, 4 bits for each
-	//in case of k=17, takes 8Gb
-	static const size_t COUNTER_LEN = std::pow(4, Parameters::get().kmerSize) / 2;
+	//in case of k=17, takes 8Gb. The length is only computed here,
+	//since 4^k does not fit into size_t for larger k-mers
 	if (useFlatCounter)
 	{
-		_flatCounter = new std::atomic<uint8_t>[COUNTER_LEN];
-		std::memset(_flatCounter, 0, COUNTER_LEN);
+		_flatCounterLen = ((size_t)1 << (2 * Parameters::get().kmerSize)) / 2;
+		_flatCounter = new std::atomic<uint8_t>[_flatCounterLen];
+		std::memset(_flatCounter, 0, _flatCounterLen);
 	}
  
 	if (_outputProgress) Logger::get().info() << "Counting k-mers:";
@@ -522,7 +996,7 @@ void KmerCounter::count(bool useFlatCounter)
 	{
 		if (!readId.strand()) return;
 		
-		for (auto kmerPos : IterKmers(_seqContainer.getSeq(readId)))
+		for (auto kmerPos : BasicIterKmers<KmerT>(_seqContainer.getSeq(readId)))
 		{
 			kmerPos.kmer.standardForm();
 			bool addOne = true;
@@ -564,22 +1038,67 @@ void KmerCounter::count(bool useFlatCounter)
 	processInParallel(allReads, readUpdate, Parameters::get().numThreads, _outputProgress);
 
 	Logger::get().debug() << "Updating k-mer histogram";
-	if (_useFlatCounter)
+	//frequencies are first accumulated in arrays, and only the
+	//rare higher ones go to the maps, which are merged at the end
+	const size_t SMALL_FREQ = 1024;
+	std::mutex histMutex;
+	auto mergeHist = [this, &histMutex] (const std::vector<size_t>& smallHist,
+										 const KmerDistribution& largeHist)
 	{
-		for (size_t kmerId = 0; kmerId < COUNTER_LEN * 2; ++kmerId)
+		std::lock_guard<std::mutex> lock(histMutex);
+		for (size_t freq = 1; freq < smallHist.size(); ++freq)
 		{
-			Kmer kmer(kmerId);
-			size_t freq = this->getFreq(kmer);
-			if (freq > 0) _kmerDistribution[freq] += 1;
-			//if (kmerId % 1000000 == 0) Logger::get().debug() << kmerId << " " << freq;
+			if (smallHist[freq]) _kmerDistribution[freq] += smallHist[freq];
 		}
+		for (const auto& freqCount : largeHist)
+		{
+			_kmerDistribution[freqCount.first] += freqCount.second;
+		}
+	};
+
+	if (_useFlatCounter)
+	{
+		//the flat counter is split into ranges, processed in parallel
+		const size_t RANGE = 1024 * 1024;
+		std::vector<size_t> ranges;
+		for (size_t i = 0; i < _flatCounterLen; i += RANGE) ranges.push_back(i);
+
+		std::function<void(const size_t&)> rangeHist = 
+		[this, &mergeHist, RANGE, SMALL_FREQ] (const size_t& rangeStart)
+		{
+			std::vector<size_t> smallHist(SMALL_FREQ, 0);
+			KmerDistribution largeHist;
+			size_t rangeEnd = std::min(rangeStart + RANGE, _flatCounterLen);
+			for (size_t arrayPos = rangeStart; arrayPos < rangeEnd; ++arrayPos)
+			{
+				uint8_t packed = _flatCounter[arrayPos];
+				if (!packed) continue;
+
+				for (size_t kmerId = arrayPos * 2; kmerId < arrayPos * 2 + 2; ++kmerId)
+				{
+					uint8_t count = (kmerId % 2) ? packed >> 4 : packed & 15;
+					//saturated counts are continued in the hash counter
+					size_t freq = count < 15 ? count : this->getFreq(KmerT(kmerId));
+					if (freq < SMALL_FREQ) ++smallHist[freq];
+					else ++largeHist[freq];
+				}
+			}
+			mergeHist(smallHist, largeHist);
+		};
+		processInParallel(ranges, rangeHist, 
+						  Parameters::get().numThreads, false);
 	}
 	else
 	{
+		//the locked table could only be iterated sequentially
+		std::vector<size_t> smallHist(SMALL_FREQ, 0);
+		KmerDistribution largeHist;
 		for (const auto& kmer : _hashCounter.lock_table())
 		{
-			_kmerDistribution[kmer.second] += 1;
+			if (kmer.second < SMALL_FREQ) ++smallHist[kmer.second];
+			else ++largeHist[kmer.second];
 		}
+		mergeHist(smallHist, largeHist);
 	}
 
 	//Logger::get().debug() << "After counter: " 
@@ -590,7 +1109,8 @@ void KmerCounter::count(bool useFlatCounter)
 }
 
 
-size_t KmerCounter::getFreq(Kmer kmer) const
+template <class KmerT>
+size_t BasicKmerCounter<KmerT>::getFreq(KmerT kmer) const
 {
 	//kmer.standardForm();
 
@@ -615,7 +1135,8 @@ size_t KmerCounter::getFreq(Kmer kmer) const
 	return freq + addCount;
 }
 
-void KmerCounter::clear()
+template <class KmerT>
+void BasicKmerCounter<KmerT>::clear()
 {
 	_hashCounter.clear();
 	_hashCounter.reserve(0);
@@ -623,11 +1144,18 @@ void KmerCounter::clear()
 	{
 		delete[] _flatCounter;
 		_flatCounter = nullptr;
+		_flatCounterLen = 0;
 	}
 }
 
-size_t KmerCounter::getKmerNum() const
+template <class KmerT>
+size_t BasicKmerCounter<KmerT>::getKmerNum() const
 {
 	if (!_useFlatCounter) return _hashCounter.size();
 	return _numKmers;
 }
+
+template class BasicKmerCounter<Kmer>;
+template class BasicKmerCounter<LongKmer>;
+template class BasicVertexIndex<Kmer>;
+template class BasicVertexIndex<LongKmer>;
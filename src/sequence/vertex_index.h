@@ -11,6 +11,7 @@
 #include <vector>
 #include <iostream>
 #include <cstring>
+#include <memory>
 
 #include <cuckoohash_map.hh>
 
@@ -18,19 +19,21 @@
 #include "sequence_container.h"
 #include "../common/config.h"
 #include "../common/logger.h"
+#include "../common/bloom_filter.h"
 
 
 typedef std::map<size_t, size_t> KmerDistribution;
 
-class KmerCounter
+template <class KmerT>
+class BasicKmerCounter
 {
 public:
-	KmerCounter(const SequenceContainer& seqContainer):
+	BasicKmerCounter(const SequenceContainer& seqContainer):
 		_seqContainer(seqContainer), 
-		_flatCounter(nullptr), _numKmers(0)
+		_flatCounter(nullptr), _flatCounterLen(0), _numKmers(0)
 	{}
 
-	~KmerCounter()
+	~BasicKmerCounter()
 	{
 		if (_flatCounter) 
 		{
@@ -45,7 +48,7 @@ public:
 	}
 
 	void   count(bool useFlatCounter);
-	size_t getFreq(Kmer kmer) const;
+	size_t getFreq(KmerT kmer) const;
 	size_t getKmerNum() const;
 	void clear();
 	void setOutputProgress(bool progress) {_outputProgress = progress;}
@@ -56,21 +59,23 @@ private:
 	bool _useFlatCounter;
 
 	std::atomic<uint8_t>*			_flatCounter;
+	size_t							_flatCounterLen;
 	//std::vector<std::atomic<char>>  _flatCounter;
-	cuckoohash_map<Kmer, size_t> 	_hashCounter;
+	cuckoohash_map<KmerT, size_t> 	_hashCounter;
 	KmerDistribution _kmerDistribution;
 
 	std::atomic<size_t> _numKmers;
 };
 
-class VertexIndex
+template <class KmerT>
+class BasicVertexIndex
 {
 public:
-	~VertexIndex()
+	~BasicVertexIndex()
 	{
 		this->clear();
 	}
-	VertexIndex(const SequenceContainer& seqContainer, float sampleRate):
+	BasicVertexIndex(const SequenceContainer& seqContainer, float sampleRate):
 		_seqContainer(seqContainer), _outputProgress(false), 
 		_sampleRate(sampleRate), _repetitiveFrequency(0),
 		_kmerCounter(seqContainer)
@@ -78,8 +83,8 @@ public:
 		//_flankRepeatSize(flankRepeatSize)
 	{}
 
-	VertexIndex(const VertexIndex&) = delete;
-	void operator=(const VertexIndex&) = delete;
+	BasicVertexIndex(const BasicVertexIndex&) = delete;
+	void operator=(const BasicVertexIndex&) = delete;
 
 private:
 	struct IndexChunk
@@ -115,15 +120,6 @@ private:
 
 	//static const size_t MAX_INDEX = 1ULL << (sizeof(IndexChunk) * 8);
 
-	struct ReadPosition
-	{
-		ReadPosition(FastaRecord::Id readId = FastaRecord::ID_NONE, 
-					 int32_t position = 0):
-			readId(readId), position(position) {}
-		FastaRecord::Id readId;
-		int32_t position;
-	};
-
 	struct ReadVector
 	{
 		ReadVector(uint32_t capacity = 0, uint32_t size = 0): 
@@ -136,6 +132,15 @@ private:
 public:
 	typedef std::map<size_t, size_t> KmerDistribution;
 
+	struct ReadPosition
+	{
+		ReadPosition(FastaRecord::Id readId = FastaRecord::ID_NONE, 
+					 int32_t position = 0):
+			readId(readId), position(position) {}
+		FastaRecord::Id readId;
+		int32_t position;
+	};
+
 	class KmerPosIterator
 	{
 	public:
@@ -157,20 +162,8 @@ public:
 		//__attribute__((always_inline))
 		ReadPosition operator*() const
 		{
-			size_t globPos = rv.data[index].get();
-			FastaRecord::Id seqId;
-			int32_t position;
-			int32_t seqLen;
-			seqContainer.seqPosition(globPos, seqId, position, seqLen);
-
-			if (!revComp)
-			{
-				return ReadPosition(seqId, position);
-			}
-			else
-			{
-				return ReadPosition(seqId.rc(), seqLen - position - kmerSize);
-			}
+			return decodePosition(rv.data[index].get(), revComp, 
+								  seqContainer, kmerSize);
 		}
 
 		KmerPosIterator& operator++()
@@ -204,6 +197,35 @@ public:
 			return KmerPosIterator(rv, rv.size, revComp, seqContainer);
 		}
 
+		size_t size() const {return rv.size;}
+
+		//the first step of the batched decoding: prefetches the sequence
+		//offsets for all positions, so the translation of the positions
+		//of multiple k-mers does not stall on each of them in turn
+		void prefetchPositions() const
+		{
+			for (size_t i = 0; i < rv.size; ++i)
+			{
+				seqContainer.prefetchPosition(rv.data[i].get());
+			}
+		}
+
+		void decodePositions(std::vector<ReadPosition>& out) const
+		{
+			size_t kmerSize = Parameters::get().kmerSize;
+			for (size_t i = 0; i < rv.size; ++i)
+			{
+				out.push_back(decodePosition(rv.data[i].get(), revComp, 
+											 seqContainer, kmerSize));
+			}
+		}
+
+		//the position array is usually within a single cache line
+		void prefetchData() const
+		{
+			if (rv.size) __builtin_prefetch(rv.data);
+		}
+
 	private:
 		ReadVector rv;
 		bool revComp;
@@ -217,7 +239,11 @@ public:
 	void buildIndexMinimizers(int minCoverage, int wndLen);
 	void clear();
 
-	IterHelper iterKmerPos(Kmer kmer) const
+	//binary serialization of the built index (for checkpoints)
+	void saveIndex(std::ostream& out);
+	void loadIndex(std::istream& in);
+
+	IterHelper iterKmerPos(KmerT kmer) const
 	{
 		bool revComp = kmer.standardForm();
 		return IterHelper(_kmerIndex.find(kmer), revComp,
@@ -225,19 +251,19 @@ public:
 	}
 
 	//__attribute__((always_inline))
-	/*bool isSolid(Kmer kmer) const
+	/*bool isSolid(KmerT kmer) const
 	{
 		kmer.standardForm();
 		return _kmerIndex.contains(kmer);
 	}*/
 
-	bool isRepetitive(Kmer kmer) const
+	bool isRepetitive(KmerT kmer) const
 	{
 		kmer.standardForm();
 		return _repetitiveKmers.contains(kmer);
 	}
 	
-	size_t kmerFreq(Kmer kmer) const
+	size_t kmerFreq(KmerT kmer) const
 	{
 		kmer.standardForm();
 		ReadVector rv;
@@ -245,6 +271,39 @@ public:
 		return rv.size;
 	}
 
+	//combined query for the overlap seeding: the k-mer is canonized once,
+	//and the k-mers that are absent from both tables (most of the k-mers
+	//with sequencing errors) are rejected by the filter without probing them.
+	//Positions are empty for the absent and repetitive k-mers
+	struct KmerLookup
+	{
+		bool repetitive;
+		IterHelper positions;
+	};
+
+	//batched lookupKmer: the filter blocks, the hash table buckets and
+	//then the position arrays of the whole batch are prefetched before
+	//they are accessed, so the cache misses of the different k-mers overlap
+	void lookupKmers(const std::vector<BasicKmerPosition<KmerT>>& kmers,
+					 std::vector<KmerLookup>& out) const;
+
+	KmerLookup lookupKmer(KmerT kmer) const
+	{
+		bool revComp = kmer.standardForm();
+		ReadVector rv;
+		if (!_kmerFilter.mayContain(kmer.hash()))
+		{
+			return {false, IterHelper(rv, revComp, _seqContainer)};
+		}
+		//solid and repetitive k-mers do not intersect
+		if (_kmerIndex.find(kmer, rv))
+		{
+			return {false, IterHelper(rv, revComp, _seqContainer)};
+		}
+		return {_repetitiveKmers.contains(kmer), 
+				IterHelper(rv, revComp, _seqContainer)};
+	}
+
 	void outputProgress(bool set) 
 	{
 		_outputProgress = set;
@@ -265,7 +324,7 @@ private:
 
 	struct KmerFreq
 	{
-		Kmer kmer;
+		KmerT kmer;
 		int32_t position;
 		size_t freq;
 	};
@@ -273,7 +332,34 @@ private:
 		yieldFrequentKmers(const FastaRecord::Id& seqId,
 						   float selctRate, int tandemFreq);
 
+	static ReadPosition decodePosition(size_t globPos, bool revComp,
+									   const SequenceContainer& seqContainer,
+									   size_t kmerSize)
+	{
+		FastaRecord::Id seqId;
+		int32_t position;
+		int32_t seqLen;
+		seqContainer.seqPosition(globPos, seqId, position, seqLen);
+
+		if (!revComp)
+		{
+			return ReadPosition(seqId, position);
+		}
+		else
+		{
+			return ReadPosition(seqId.rc(), seqLen - position - kmerSize);
+		}
+	}
+
+	void fillIndexSinglePass(const std::vector<FastaRecord::Id>& allReads,
+							 int globalMinFreq, float selectRate, int tandemFreq);
+	void fillIndexTwoPass(const std::vector<FastaRecord::Id>& allReads,
+						  int globalMinFreq, float selectRate, int tandemFreq);
 	void allocateIndexMemory();
+	void sortIndexPositions();
+	void buildKmerFilter();
+	IndexChunk* allocateChunk();
+	void fitIndexIntoBudget(size_t padding);
 	void filterFrequentKmers(int minCoverage, float rate);
 
 	const SequenceContainer& _seqContainer;
@@ -286,9 +372,112 @@ private:
 	const size_t MEM_CHUNK = 32 * 1024 * 1024 / sizeof(IndexChunk);
 	std::vector<IndexChunk*> _memoryChunks;
 
-	cuckoohash_map<Kmer, ReadVector> _kmerIndex;
-	//cuckoohash_map<Kmer, size_t> 	 _kmerCounts;
-	cuckoohash_map<Kmer, char> 	 	 _repetitiveKmers;
+	cuckoohash_map<KmerT, ReadVector> _kmerIndex;
+	//cuckoohash_map<KmerT, size_t> 	 _kmerCounts;
+	cuckoohash_map<KmerT, char> 	 	 _repetitiveKmers;
+	BlockedBloomFilter				 _kmerFilter;
+
+	BasicKmerCounter<KmerT> _kmerCounter;
+};
+
+//The k-mer width is selected at runtime: the index is built over
+//the regular 64-bit k-mers if they fit, and over the 128-bit ones
+//otherwise. The building interface is forwarded to the selected index,
+//while the lookups are made through the typed index directly, so
+//the seeding loops are instantiated for each width (see OverlapDetector)
+class VertexIndex
+{
+public:
+	typedef BasicVertexIndex<Kmer> ShortIndex;
+	typedef BasicVertexIndex<LongKmer> LongIndex;
+
+	VertexIndex(const SequenceContainer& seqContainer, float sampleRate)
+	{
+		if (Parameters::get().kmerSize <= Kmer::MAX_SIZE)
+		{
+			_shortIndex.reset(new ShortIndex(seqContainer, sampleRate));
+		}
+		else if (Parameters::get().kmerSize <= LongKmer::MAX_SIZE)
+		{
+			_longIndex.reset(new LongIndex(seqContainer, sampleRate));
+		}
+		else
+		{
+			throw std::runtime_error("K-mer size is too large");
+		}
+	}
+
+	VertexIndex(const VertexIndex&) = delete;
+	void operator=(const VertexIndex&) = delete;
+
+	void countKmers()
+	{
+		if (_shortIndex) _shortIndex->countKmers();
+		else _longIndex->countKmers();
+	}
+
+	void buildIndexUnevenCoverage(int minCoverage, float selectRate, 
+								  int tandemFreq)
+	{
+		if (_shortIndex) 
+		{
+			_shortIndex->buildIndexUnevenCoverage(minCoverage, selectRate, 
+												  tandemFreq);
+		}
+		else
+		{
+			_longIndex->buildIndexUnevenCoverage(minCoverage, selectRate, 
+												 tandemFreq);
+		}
+	}
+
+	void buildIndexMinimizers(int minCoverage, int wndLen)
+	{
+		if (_shortIndex) _shortIndex->buildIndexMinimizers(minCoverage, wndLen);
+		else _longIndex->buildIndexMinimizers(minCoverage, wndLen);
+	}
 
-	KmerCounter _kmerCounter;
+	void clear()
+	{
+		if (_shortIndex) _shortIndex->clear();
+		else _longIndex->clear();
+	}
+
+	void saveIndex(std::ostream& out)
+	{
+		if (_shortIndex) _shortIndex->saveIndex(out);
+		else _longIndex->saveIndex(out);
+	}
+
+	void loadIndex(std::istream& in)
+	{
+		if (_shortIndex) _shortIndex->loadIndex(in);
+		else _longIndex->loadIndex(in);
+	}
+
+	void outputProgress(bool set) 
+	{
+		if (_shortIndex) _shortIndex->outputProgress(set);
+		else _longIndex->outputProgress(set);
+	}
+
+	const KmerDistribution& getKmerHist() const
+	{
+		return _shortIndex ? _shortIndex->getKmerHist() : 
+							 _longIndex->getKmerHist();
+	}
+
+	float getSampleRate() const 
+	{
+		return _shortIndex ? _shortIndex->getSampleRate() : 
+							 _longIndex->getSampleRate();
+	}
+
+	bool longKmers() const {return (bool)_longIndex;}
+	const ShortIndex& shortIndex() const {return *_shortIndex;}
+	const LongIndex& longIndex() const {return *_longIndex;}
+
+private:
+	std::unique_ptr<ShortIndex> _shortIndex;
+	std::unique_ptr<LongIndex> 	_longIndex;
 };